@@ -65,7 +65,7 @@ public:
 
     bool IsSwitchOn(const std::string s)
     {
-        return onSwitches.find(s) != switches.end();
+        return onSwitches.find(s) != onSwitches.end();
     }
 
     void ParseArgs(int argc, char **argv)
@@ -6,7 +6,17 @@
 struct Function
 {
     oprand_t arity;
+    // bytes taken up by the arguments at the start of the frame
+    oprand_t arg_size = 0;
+    // the most bytes the function's frame, arguments included,
+    // grows the stack by - worked out by the compiler so the
+    // VM can reserve the space once per call
+    oprand_t max_stack = 0;
     std::vector<std::vector<Op>> routines;
+    // the routines laid out contiguously, with branches
+    // as absolute offsets - filled in when the VM links
+    // the function
+    std::vector<Op> code;
 
     // constants
     std::vector<int> ints;
@@ -35,32 +45,38 @@ struct Function
           chars(_chars),
           strings(_strings)
     {
-        routines.push_back(std::vector<Op>());
+        // the last routine is the one running off the end of the
+        // function, so an empty one is only added when there are none
+        if (routines.empty())
+            routines.push_back(std::vector<Op>());
     };
 
+    void PrintOp(const Op &o)
+    {
+        std::cout << ToString(o.code);
+        if (o.code == Opcode::LOAD_INT)
+            std::cout << " at index: " << +o.op << " value: " << ints[o.op];
+        else if (o.code == Opcode::LOAD_DOUBLE)
+            std::cout << " at index: " << +o.op << " value: " << doubles[o.op];
+        else if (o.code == Opcode::LOAD_BOOL)
+            std::cout << " at index: " << +o.op << " value: " << (bools[o.op] ? "true" : "false");
+        else if (o.code == Opcode::LOAD_STRING)
+            std::cout << " at index: " << +o.op << " value: " << strings[o.op];
+        else if (o.code == Opcode::LOAD_CHAR)
+            std::cout << " at index: " << +o.op << " value: " << chars[o.op];
+        else
+            std::cout << " " << +o.op;
+
+        std::cout << std::endl;
+    }
+
     void PrintCode()
     {
         for (size_t i = 0; i < routines.size(); i++)
         {
             std::cout << "L" << i << ":" << std::endl;
             for (const auto &o : routines[i])
-            {
-                std::cout << ToString(o.code);
-                if (o.code == Opcode::LOAD_INT)
-                    std::cout << " at index: " << +o.op << " value: " << ints[o.op];
-                else if (o.code == Opcode::LOAD_DOUBLE)
-                    std::cout << " at index: " << +o.op << " value: " << doubles[o.op];
-                else if (o.code == Opcode::LOAD_BOOL)
-                    std::cout << " at index: " << +o.op << " value: " << (bools[o.op] ? "true" : "false");
-                else if (o.code == Opcode::LOAD_STRING)
-                    std::cout << " at index: " << +o.op << " value: " << strings[o.op];
-                else if (o.code == Opcode::LOAD_CHAR)
-                    std::cout << " at index: " << +o.op << " value: " << chars[o.op];
-                else
-                    std::cout << " " << +o.op;
-
-                std::cout << std::endl;
-            }
+                PrintOp(o);
 
             std::cout << "\n\n";
         }
@@ -0,0 +1,12 @@
+#pragma once
+#include "internaltypes.h"
+#include <vector>
+
+// Where the globals segment holds addresses, as offsets into it, so a
+// snapshot can move them without taking other bytes for one. Arrays
+// and structs always hold one, a string only when it is not inline
+struct GlobalRefs
+{
+    std::vector<oprand_t> strings;
+    std::vector<oprand_t> pointers;
+};
\ No newline at end of file
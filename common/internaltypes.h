@@ -5,8 +5,10 @@
 using TypeID = uint8_t;
 constexpr size_t MAX_TYPE = UINT8_MAX;
 
-using oprand_t = size_t;
-constexpr size_t MAX_OPRAND = SIZE_MAX;
+// operands are constant pool indices, stack offsets and code offsets,
+// none of which get near 2^32, so Op packs into 8 bytes
+using oprand_t = uint32_t;
+constexpr size_t MAX_OPRAND = UINT32_MAX;
 
 using op_t = uint8_t;
 constexpr size_t MAX_OP = UINT8_MAX;
\ No newline at end of file
@@ -5,6 +5,11 @@ public:
     std::string name;
     std::string library;
     size_t arity;
-    LibraryFunctionDef(std::string _name, std::string _library, size_t _arity) : name(_name), library(_library), arity(_arity){};
+    // bytes the arguments take up on the stack and the
+    // bytes of the return value written back over them
+    size_t arg_size;
+    size_t ret_size;
+    LibraryFunctionDef(std::string _name, std::string _library, size_t _arity, size_t _arg_size, size_t _ret_size)
+        : name(_name), library(_library), arity(_arity), arg_size(_arg_size), ret_size(_ret_size){};
 };
 
@@ -0,0 +1,14 @@
+#pragma once
+
+// Every native function, in NATIVE_CALL oprand order, as the name of
+// its C++ implementation and its signature in the language. Expanded
+// into the compiler's overloads and the runtime's dispatch table so
+// the two cannot drift apart. The implementation's parameter and
+// return types must match the signature
+#define NATIVES(x)                           \
+    x(PrintInt, "void Print(int)")           \
+    x(PrintDouble, "void Print(double)")     \
+    x(PrintBool, "void Print(bool)")         \
+    x(PrintString, "void Print(string)")     \
+    x(PrintChar, "void Print(char)")         \
+    x(Length, "int Length(string)")
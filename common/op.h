@@ -2,158 +2,223 @@
 #include "internaltypes.h"
 #include <string>
 
+// Every opcode, in encoding order. Expanded into the Opcode enum below
+// and into the VM's dispatch table so the two cannot drift apart
+#define OPCODES(x)                            \
+    x(POP)                                    \
+    x(LOAD_INT)                               \
+    x(LOAD_DOUBLE)                            \
+    x(LOAD_BOOL)                              \
+    x(LOAD_STRING)                            \
+    x(LOAD_CHAR)                              \
+                                              \
+    /* variables */                           \
+    x(INT_ASSIGN)                             \
+    x(DOUBLE_ASSIGN)                          \
+    x(BOOL_ASSIGN)                            \
+    x(STRING_ASSIGN)                          \
+    x(CHAR_ASSIGN)                            \
+    x(ARRAY_ASSIGN)                           \
+    x(STRUCT_ASSIGN)                          \
+                                              \
+    x(INT_ASSIGN_GLOBAL)                      \
+    x(DOUBLE_ASSIGN_GLOBAL)                   \
+    x(BOOL_ASSIGN_GLOBAL)                     \
+    x(STRING_ASSIGN_GLOBAL)                   \
+    x(CHAR_ASSIGN_GLOBAL)                     \
+    x(ARRAY_ASSIGN_GLOBAL)                    \
+    x(STRUCT_ASSIGN_GLOBAL)                   \
+                                              \
+    /* pushes the oprand onto the stack */    \
+    /* by value */                            \
+    x(PUSH)                                   \
+    x(PUSH_SP_OFFSET)                         \
+                                              \
+    x(GET_INT)                                \
+    x(GET_DOUBLE)                             \
+    x(GET_BOOL)                               \
+    x(GET_STRING)                             \
+    x(GET_CHAR)                               \
+    x(GET_ARRAY)                              \
+    x(GET_STRUCT)                             \
+                                              \
+    x(GET_INT_GLOBAL)                         \
+    x(GET_DOUBLE_GLOBAL)                      \
+    x(GET_BOOL_GLOBAL)                        \
+    x(GET_STRING_GLOBAL)                      \
+    x(GET_CHAR_GLOBAL)                        \
+    x(GET_ARRAY_GLOBAL)                       \
+    x(GET_STRUCT_GLOBAL)                      \
+                                              \
+    /* arrays and arrays */                   \
+    x(ARR_INDEX)                              \
+    x(ARR_SET)                                \
+    x(ARR_ALLOC)                              \
+    /* ARR_INDEX and ARR_SET for indices  */  \
+    /* the compiler proved are in range   */  \
+    x(ARR_INDEX_UNCHECKED)                    \
+    x(ARR_SET_UNCHECKED)                      \
+                                              \
+    x(STRING_INDEX)                           \
+    x(STRING_SET)                             \
+                                              \
+    /* control flow */                        \
+    x(SET_IP)                                 \
+    x(GOTO_LABEL)                             \
+    x(GOTO_LABEL_IF_FALSE)                    \
+                                              \
+    /* functions */                           \
+    x(CALL_F)                                 \
+    /* CALL_F that replaces the caller's */    \
+    /* frame, for calls in tail position */    \
+    x(TAIL_CALL)                              \
+    x(CALL_LIBRARY_FUNC)                      \
+    /* CALL_F of a function loaded from a */  \
+    /* module built with -emit-cpp       */  \
+    x(CALL_AOT)                               \
+    x(RETURN)                                 \
+    x(RETURN_VOID)                            \
+                                              \
+    x(THROW)                                  \
+                                              \
+    x(NATIVE_CALL)                            \
+    /* prints the value on top, of the    */  \
+    /* type the oprand names              */  \
+    x(PRINT)                                  \
+                                              \
+    /* structs */                             \
+    x(STRUCT_MEMBER)                          \
+    x(STRUCT_D)                               \
+    x(STRUCT_MEMBER_SET)                      \
+    x(CAST)                                   \
+                                              \
+    /* ADDITION */                            \
+    x(I_ADD)                                  \
+    x(DI_ADD)                                 \
+    x(ID_ADD)                                 \
+    x(D_ADD)                                  \
+    /* string concatenation */                \
+    x(S_ADD)                                  \
+                                              \
+    /* SUBTRACTION */                         \
+    x(I_SUB)                                  \
+    x(DI_SUB)                                 \
+    x(ID_SUB)                                 \
+    x(D_SUB)                                  \
+                                              \
+    /* MULTIPLICATION */                      \
+    x(I_MUL)                                  \
+    x(DI_MUL)                                 \
+    x(ID_MUL)                                 \
+    x(D_MUL)                                  \
+                                              \
+    /* DIVISION */                            \
+    x(I_DIV)                                  \
+    x(DI_DIV)                                 \
+    x(ID_DIV)                                 \
+    x(D_DIV)                                  \
+                                              \
+    /* GT, */                                 \
+    x(I_GT)                                   \
+    x(DI_GT)                                  \
+    x(ID_GT)                                  \
+    x(D_GT)                                   \
+                                              \
+    /* LT, */                                 \
+    x(I_LT)                                   \
+    x(DI_LT)                                  \
+    x(ID_LT)                                  \
+    x(D_LT)                                   \
+                                              \
+    /* GEQ, */                                \
+    x(I_GEQ)                                  \
+    x(DI_GEQ)                                 \
+    x(ID_GEQ)                                 \
+    x(D_GEQ)                                  \
+                                              \
+    /* LEQ, */                                \
+    x(I_LEQ)                                  \
+    x(DI_LEQ)                                 \
+    x(ID_LEQ)                                 \
+    x(D_LEQ)                                  \
+                                              \
+    /* EQ_EQ, */                              \
+    x(N_EQ_EQ)                                \
+    x(I_EQ_EQ)                                \
+    x(DI_EQ_EQ)                               \
+    x(ID_EQ_EQ)                               \
+    x(D_EQ_EQ)                                \
+    x(B_EQ_EQ)                                \
+                                              \
+    /* BANG_EQ, */                            \
+    x(N_BANG_EQ)                              \
+    x(I_BANG_EQ)                              \
+    x(DI_BANG_EQ)                             \
+    x(ID_BANG_EQ)                             \
+    x(D_BANG_EQ)                              \
+    x(B_BANG_EQ)                              \
+                                              \
+    x(B_AND_AND)                              \
+    x(B_OR_OR)                                \
+                                              \
+    x(BANG)                                   \
+                                              \
+    /* superinstructions - the VM fuses */    \
+    /* these over the sequences they    */    \
+    /* replace, the compiler never      */    \
+    /* emits them                       */    \
+    x(GET_INT_GET_INT)                        \
+    x(INT_ADD_ASSIGN)                         \
+    x(INT_ADD_CONST_ASSIGN)                   \
+    x(INT_LT_JUMP_IF_FALSE)                   \
+    x(INT_LEQ_JUMP_IF_FALSE)                  \
+    x(INT_GT_JUMP_IF_FALSE)                   \
+    x(INT_GEQ_JUMP_IF_FALSE)                  \
+    x(INT_EQ_EQ_JUMP_IF_FALSE)                \
+    x(INT_BANG_EQ_JUMP_IF_FALSE)              \
+    x(INT_LT_CONST_JUMP_IF_FALSE)             \
+    x(INT_LEQ_CONST_JUMP_IF_FALSE)            \
+    x(INT_GT_CONST_JUMP_IF_FALSE)             \
+    x(INT_GEQ_CONST_JUMP_IF_FALSE)            \
+    x(INT_EQ_EQ_CONST_JUMP_IF_FALSE)          \
+    x(INT_BANG_EQ_CONST_JUMP_IF_FALSE)        \
+                                              \
+    /* three-address register ops - see */    \
+    /* REG_* below for their oprands    */    \
+    x(R_I_MOV)                                \
+    x(R_I_ADD)                                \
+    x(R_I_SUB)                                \
+    x(R_I_MUL)                                \
+    x(R_I_DIV)                                \
+    x(R_I_LT_JUMP_IF_FALSE)                   \
+    x(R_I_LEQ_JUMP_IF_FALSE)                  \
+    x(R_I_GT_JUMP_IF_FALSE)                   \
+    x(R_I_GEQ_JUMP_IF_FALSE)                  \
+    x(R_I_EQ_EQ_JUMP_IF_FALSE)                \
+    x(R_I_BANG_EQ_JUMP_IF_FALSE)              \
+    x(R_D_MOV)                                \
+    x(R_D_ADD)                                \
+    x(R_D_SUB)                                \
+    x(R_D_MUL)                                \
+    x(R_D_DIV)                                \
+    x(R_D_LT_JUMP_IF_FALSE)                   \
+    x(R_D_LEQ_JUMP_IF_FALSE)                  \
+    x(R_D_GT_JUMP_IF_FALSE)                   \
+    x(R_D_GEQ_JUMP_IF_FALSE)                  \
+    x(R_D_EQ_EQ_JUMP_IF_FALSE)                \
+    x(R_D_BANG_EQ_JUMP_IF_FALSE)              \
+                                              \
+    x(NONE)
+
 enum class Opcode : op_t
 {
-    POP,
-    LOAD_INT,
-    LOAD_DOUBLE,
-    LOAD_BOOL,
-    LOAD_STRING,
-    LOAD_CHAR,
-
-    // variables
-    INT_ASSIGN,
-    DOUBLE_ASSIGN,
-    BOOL_ASSIGN,
-    STRING_ASSIGN,
-    CHAR_ASSIGN,
-    ARRAY_ASSIGN,
-    STRUCT_ASSIGN,
-
-    INT_ASSIGN_GLOBAL,
-    DOUBLE_ASSIGN_GLOBAL,
-    BOOL_ASSIGN_GLOBAL,
-    STRING_ASSIGN_GLOBAL,
-    CHAR_ASSIGN_GLOBAL,
-    ARRAY_ASSIGN_GLOBAL,
-    STRUCT_ASSIGN_GLOBAL,
-
-    // pushes the oprand onto the stack
-    // by value
-    PUSH,
-    PUSH_SP_OFFSET,
-
-    GET_INT,
-    GET_DOUBLE,
-    GET_BOOL,
-    GET_STRING,
-    GET_CHAR,
-    GET_ARRAY,
-    GET_STRUCT,
-
-    GET_INT_GLOBAL,
-    GET_DOUBLE_GLOBAL,
-    GET_BOOL_GLOBAL,
-    GET_STRING_GLOBAL,
-    GET_CHAR_GLOBAL,
-    GET_ARRAY_GLOBAL,
-    GET_STRUCT_GLOBAL,
-
-    // arrays and arrays
-    ARR_INDEX,
-    ARR_SET,
-    ARR_ALLOC,
-
-    STRING_INDEX,
-    STRING_SET,
-
-    // control flow
-    SET_IP,
-    GOTO_LABEL,
-    GOTO_LABEL_IF_FALSE,
-
-    // functions
-    CALL_F,
-    CALL_LIBRARY_FUNC,
-    RETURN,
-    RETURN_VOID,
-
-    PUSH_THROW_INFO,
-    THROW,
-
-    NATIVE_CALL,
-    PRINT,
-
-    // structs
-    STRUCT_MEMBER,
-    STRUCT_D,
-    STRUCT_MEMBER_SET,
-    CAST,
-
-    // ADDITION
-    I_ADD,
-    DI_ADD,
-    ID_ADD,
-    D_ADD,
-    // string concatenation
-    S_ADD,
-
-    // SUBTRACTION
-    I_SUB,
-    DI_SUB,
-    ID_SUB,
-    D_SUB,
-
-    // MULTIPLICATION
-    I_MUL,
-    DI_MUL,
-    ID_MUL,
-    D_MUL,
-
-    // DIVISION
-    I_DIV,
-    DI_DIV,
-    ID_DIV,
-    D_DIV,
-
-    // GT,
-    I_GT,
-    DI_GT,
-    ID_GT,
-    D_GT,
-
-    // LT,
-    I_LT,
-    DI_LT,
-    ID_LT,
-    D_LT,
-
-    // GEQ,
-    I_GEQ,
-    DI_GEQ,
-    ID_GEQ,
-    D_GEQ,
-
-    // LEQ,
-    I_LEQ,
-    DI_LEQ,
-    ID_LEQ,
-    D_LEQ,
-
-    // EQ_EQ,
-    N_EQ_EQ,
-    I_EQ_EQ,
-    DI_EQ_EQ,
-    ID_EQ_EQ,
-    D_EQ_EQ,
-    B_EQ_EQ,
-
-    // BANG_EQ,
-    N_BANG_EQ,
-    I_BANG_EQ,
-    DI_BANG_EQ,
-    ID_BANG_EQ,
-    D_BANG_EQ,
-    B_BANG_EQ,
-
-    B_AND_AND,
-    B_OR_OR,
-
-    BANG,
-
-    NONE,
+#define x(name) name,
+    OPCODES(x)
+#undef x
 };
 
+constexpr size_t NUM_OPCODES = static_cast<size_t>(Opcode::NONE) + 1;
+
 struct Op
 {
     Opcode code;
@@ -161,398 +226,26 @@ struct Op
     Op(Opcode _code, oprand_t _op) : code(_code), op(_op){};
 };
 
+static_assert(sizeof(Op) == 8, "Op should pack into 8 bytes");
+
+// Register instructions carry their extra oprands in the NONE ops
+// that follow them. R_*_MOV is 'dest, src', the arithmetic ops are
+// 'dest, left, right' and the jumps are 'target, left, right' and
+// branch when the comparison is false. Each oprand names a stack slot
+// by offset, a constant by REG_CONST | index, or the top of the stack
+// with REG_STACK - popped as a source, pushed as a dest
+constexpr oprand_t REG_CONST = 0x80000000;
+constexpr oprand_t REG_STACK = 0xFFFFFFFF;
+
 inline std::string ToString(Opcode o)
 {
     switch (o)
     {
-    case Opcode::POP:
-    {
-        return "POP";
-    }
-    case Opcode::LOAD_INT:
-    {
-        return "LOAD_INT";
-    }
-    case Opcode::LOAD_DOUBLE:
-    {
-        return "LOAD_DOUBLE";
-    }
-    case Opcode::LOAD_BOOL:
-    {
-        return "LOAD_BOOL";
-    }
-    case Opcode::LOAD_STRING:
-    {
-        return "LOAD_STRING";
-    }
-    case Opcode::LOAD_CHAR:
-    {
-        return "LOAD_CHAR";
-    }
-    case Opcode::INT_ASSIGN:
-    {
-        return "INT_ASSIGN";
-    }
-    case Opcode::DOUBLE_ASSIGN:
-    {
-        return "DOUBLE_ASSIGN";
-    }
-    case Opcode::BOOL_ASSIGN:
-    {
-        return "BOOL_ASSIGN";
-    }
-    case Opcode::STRING_ASSIGN:
-    {
-        return "STRING_ASSIGN";
-    }
-    case Opcode::CHAR_ASSIGN:
-    {
-        return "CHAR_ASSIGN";
-    }
-    case Opcode::ARRAY_ASSIGN:
-    {
-        return "ARRAY_ASSIGN";
-    }
-    case Opcode::STRUCT_ASSIGN:
-    {
-        return "STRUCT_ASSIGN";
-    }
-    case Opcode::PUSH:
-    {
-        return "PUSH";
-    }
-    case Opcode::PUSH_SP_OFFSET:
-    {
-        return "PUSH_SP_OFFSET";
-    }
-    case Opcode::GET_INT:
-    {
-        return "GET_INT";
-    }
-    case Opcode::GET_DOUBLE:
-    {
-        return "GET_DOUBLE";
-    }
-    case Opcode::GET_BOOL:
-    {
-        return "GET_BOOL";
-    }
-    case Opcode::GET_STRING:
-    {
-        return "GET_STRING";
-    }
-    case Opcode::GET_CHAR:
-    {
-        return "GET_CHAR";
-    }
-    case Opcode::GET_ARRAY:
-    {
-        return "GET_ARRAY";
-    }
-    case Opcode::GET_STRUCT:
-    {
-        return "GET_STUCT";
-    }
-    case Opcode::GET_INT_GLOBAL:
-    {
-        return "GET_INT_GLOBAL";
-    }
-    case Opcode::GET_DOUBLE_GLOBAL:
-    {
-        return "GET_DOUBLE_GLOBAL";
-    }
-    case Opcode::GET_BOOL_GLOBAL:
-    {
-        return "GET_BOOL_GLOBAL";
-    }
-    case Opcode::GET_STRING_GLOBAL:
-    {
-        return "GET_STRING_GLOBAL";
-    }
-    case Opcode::GET_CHAR_GLOBAL:
-    {
-        return "GET_CHAR_GLOBAL";
-    }
-    case Opcode::GET_ARRAY_GLOBAL:
-    {
-        return "GET_ARRAY_GLOBAL";
-    }
-    case Opcode::GET_STRUCT_GLOBAL:
-    {
-        return "GET_STRUCT_GLOBAL";
-    }
-    case Opcode::ARR_INDEX:
-    {
-        return "ARR_INDEX";
-    }
-    case Opcode::ARR_SET:
-    {
-        return "ARR_SET";
-    }
-    case Opcode::ARR_ALLOC:
-    {
-        return "ARR_ALLOC";
-    }
-    case Opcode::STRING_INDEX:
-    {
-        return "STRING_INDEX";
-    }
-    case Opcode::STRING_SET:
-    {
-        return "STRING_SET";
-    }
-    case Opcode::SET_IP:
-    {
-        return "SET_IP";
-    }
-    case Opcode::GOTO_LABEL:
-    {
-        return "GOTO_LABEL";
-    }
-    case Opcode::GOTO_LABEL_IF_FALSE:
-    {
-        return "GOTO_LABEL_IF_FALSE";
-    }
-    case Opcode::CALL_F:
-    {
-        return "CALL_F";
-    }
-    case Opcode::CALL_LIBRARY_FUNC:
-    {
-        return "CALL_LIBRARY_FUNC";
-    }
-    case Opcode::RETURN:
-    {
-        return "RETURN";
-    }
-    case Opcode::RETURN_VOID:
-    {
-        return "RETURN_VOID";
-    }
-    case Opcode::PUSH_THROW_INFO:
-    {
-        return "PUSH_THROW_INFO";
-    }
-    case Opcode::THROW:
-    {
-        return "TRHOW";
-    }
-    case Opcode::NATIVE_CALL:
-    {
-        return "NATIVE_CALL";
-    }
-    case Opcode::PRINT:
-    {
-        return "PRINT";
-    }
-    case Opcode::STRUCT_MEMBER:
-    {
-        return "STRUCT_MEMBER";
-    }
-    case Opcode::STRUCT_D:
-    {
-        return "STRUCT_D";
-    }
-    case Opcode::STRUCT_MEMBER_SET:
-    {
-        return "STRUCT_MEMBER_SET";
-    }
-    case Opcode::CAST:
-    {
-        return "CAST";
-    }
-    case Opcode::I_ADD:
-    {
-        return "I_ADD";
-    }
-    case Opcode::DI_ADD:
-    {
-        return "DI_ADD";
-    }
-    case Opcode::ID_ADD:
-    {
-        return "ID_ADD";
-    }
-    case Opcode::D_ADD:
-    {
-        return "D_ADD";
-    }
-    case Opcode::S_ADD:
-    {
-        return "S_ADD";
-    }
-    case Opcode::I_SUB:
-    {
-        return "I_SUB";
-    }
-    case Opcode::DI_SUB:
-    {
-        return "DI_SUB";
-    }
-    case Opcode::ID_SUB:
-    {
-        return "ID_SUB";
-    }
-    case Opcode::D_SUB:
-    {
-        return "D_SUB";
-    }
-    case Opcode::I_MUL:
-    {
-        return "I_MUL";
-    }
-    case Opcode::DI_MUL:
-    {
-        return "DI_MUL";
-    }
-    case Opcode::ID_MUL:
-    {
-        return "ID_MUL";
-    }
-    case Opcode::D_MUL:
-    {
-        return "D_MUL";
-    }
-    case Opcode::I_DIV:
-    {
-        return "I_DIV";
-    }
-    case Opcode::DI_DIV:
-    {
-        return "DI_DIV";
-    }
-    case Opcode::ID_DIV:
-    {
-        return "ID_DIV";
-    }
-    case Opcode::D_DIV:
-    {
-        return "D_DIV";
-    }
-    case Opcode::I_GT:
-    {
-        return "I_GT";
-    }
-    case Opcode::DI_GT:
-    {
-        return "DI_GT";
-    }
-    case Opcode::ID_GT:
-    {
-        return "ID_GT";
-    }
-    case Opcode::D_GT:
-    {
-        return "D_GT";
-    }
-    case Opcode::I_LT:
-    {
-        return "I_LT";
-    }
-    case Opcode::DI_LT:
-    {
-        return "DI_LT";
-    }
-    case Opcode::ID_LT:
-    {
-        return "ID_LT";
-    }
-    case Opcode::D_LT:
-    {
-        return "D_LT";
-    }
-    case Opcode::I_GEQ:
-    {
-        return "I_GEQ";
-    }
-    case Opcode::DI_GEQ:
-    {
-        return "DI_GEQ";
-    }
-    case Opcode::ID_GEQ:
-    {
-        return "ID_GEQ";
-    }
-    case Opcode::D_GEQ:
-    {
-        return "D_GEQ";
-    }
-    case Opcode::I_LEQ:
-    {
-        return "I_LEQ";
-    }
-    case Opcode::DI_LEQ:
-    {
-        return "DI_LEQ";
-    }
-    case Opcode::ID_LEQ:
-    {
-        return "ID_LEQ";
-    }
-    case Opcode::D_LEQ:
-    {
-        return "D_LEQ";
-    }
-    case Opcode::N_EQ_EQ:
-    {
-        return "N_EQ_EQ";
-    }
-    case Opcode::I_EQ_EQ:
-    {
-        return "I_EQ_EQ";
-    }
-    case Opcode::DI_EQ_EQ:
-    {
-        return "DI_EQ_EQ";
-    }
-    case Opcode::ID_EQ_EQ:
-    {
-        return "ID_EQ_EQ";
-    }
-    case Opcode::D_EQ_EQ:
-    {
-        return "D_EQ_EQ";
-    }
-    case Opcode::B_EQ_EQ:
-    {
-        return "B_BANG_EQ";
-    }
-    case Opcode::N_BANG_EQ:
-    {
-        return "N_BANG_EQ";
-    }
-    case Opcode::I_BANG_EQ:
-    {
-        return "I_BANG_EQ";
-    }
-    case Opcode::DI_BANG_EQ:
-    {
-        return "DI_BANG_EQ";
-    }
-    case Opcode::ID_BANG_EQ:
-    {
-        return "ID_BANG_EQ";
-    }
-    case Opcode::D_BANG_EQ:
-    {
-        return "D_BANG_EQ";
-    }
-    case Opcode::B_BANG_EQ:
-    {
-        return "B_BANG_EQ";
-    }
-    case Opcode::B_AND_AND:
-    {
-        return "B_AND_AND";
-    }
-    case Opcode::B_OR_OR:
-    {
-        return "B_OR_OR";
-    }
-    case Opcode::BANG:
-    {
-        return "BANG";
-    }
+#define x(name)         \
+    case Opcode::name:  \
+        return #name;
+        OPCODES(x)
+#undef x
     default:
     {
         return "UNRECOGNISED OPCODE " + std::to_string((uint8_t)o);
@@ -1,5 +1,7 @@
 #pragma once
+#include "internaltypes.h"
 #include <cstddef>
+#include <fstream>
 
 // Ids for serialising attributes of compilers
 // and deserialising them into a VM
@@ -11,4 +13,37 @@ constexpr size_t STRING_ID = 0xEEEEEEEEEEEEEEEE;
 constexpr size_t CODE_ID = 0xFFFFFFFFFFFFFFFF;
 constexpr size_t STRUCT_TREE_ID = 0xABABABABABABABAB;
 constexpr size_t LIB_FUNC_ID = 0xBCBCBCBCBCBCBCBC;
-constexpr size_t THROW_INFO_ID = 0xCDCDCDCDCDCDCDCD;
\ No newline at end of file
+constexpr size_t THROW_INFO_ID = 0xCDCDCDCDCDCDCDCD;
+constexpr size_t GLOBALS_ID = 0xDEDEDEDEDEDEDEDE;
+constexpr size_t GLOBAL_REFS_ID = 0xEFEFEFEFEFEFEFEF;
+
+// Oprands are serialised as unsigned LEB128 varints - 7 bits per
+// byte, least significant first, with the top bit set on every byte
+// except the last - as almost all of them fit in one or two bytes
+inline void WriteVarint(oprand_t x, std::ofstream &file)
+{
+    do
+    {
+        uint8_t byte = x & 0x7F;
+        x >>= 7;
+        if (x != 0)
+            byte |= 0x80;
+        file.put(static_cast<char>(byte));
+    } while (x != 0);
+}
+
+inline oprand_t ReadVarint(std::ifstream &file)
+{
+    oprand_t x = 0;
+    size_t shift = 0;
+    uint8_t byte;
+
+    do
+    {
+        byte = static_cast<uint8_t>(file.get());
+        x |= static_cast<oprand_t>(byte & 0x7F) << shift;
+        shift += 7;
+    } while ((byte & 0x80) && shift < 8 * sizeof(oprand_t));
+
+    return x;
+}
\ No newline at end of file
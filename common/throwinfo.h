@@ -1,21 +1,35 @@
+#pragma once
 #include <cstddef>
 #include <cstdint>
 
+// An entry in a function's exception table. Nothing runs on entry to a
+// try block, a throw looks up the entries covering where it happened,
+// innermost first, and unwinds the call stack until one catches it
 class ThrowInfo
 {
 public:
     // type of catch variable type
     bool is_array;
     TypeID type;
-    // function to return to
+    // function with the try block
     oprand_t func;
-    // index of the function's code with
-    // the beginning of the catch statement
+    // the try clause's code, from begin up to end, and index, the
+    // beginning of the catch clause. The compiler gives them as
+    // routines, which the VM turns into offsets when it links
+    oprand_t begin;
+    oprand_t end;
     oprand_t index;
-    // index on the call stack to pop call frames
-    // off until
-    size_t callStackIndex;
+    // where the catch variable goes in the frame, and its size
+    oprand_t var_loc;
+    oprand_t var_size;
 
     ThrowInfo() = default;
-    ThrowInfo(bool _is_array, uint8_t _type, uint8_t _func, uint8_t _index) : is_array(_is_array), type(_type), func(_func), index(_index), callStackIndex(0){};
+    ThrowInfo(bool _is_array, TypeID _type, oprand_t _func, oprand_t _begin, oprand_t _end, oprand_t _index, oprand_t _var_loc, oprand_t _var_size)
+        : is_array(_is_array), type(_type), func(_func), begin(_begin), end(_end), index(_index), var_loc(_var_loc), var_size(_var_size){};
+
+    // whether a value thrown by a THROW with the oprand is caught here
+    bool Catches(oprand_t thrown) const { return thrown == ThrownType(is_array, type); };
+
+    // THROW's oprand for a value of the type
+    static oprand_t ThrownType(bool is_array, TypeID type) { return (is_array ? 1U << 8 : 0U) | type; };
 };
\ No newline at end of file
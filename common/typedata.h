@@ -11,7 +11,7 @@ public:
     size_t is_array = 0;
     TypeID type = 0;
     TypeData() = default;
-    TypeData(size_t _isArray, TypeID _type) : is_array(_isArray), type(_type){};
+    constexpr TypeData(size_t _isArray, TypeID _type) : is_array(_isArray), type(_type){};
 };
 
 #define VOID_TYPE TypeData(0, 0)
@@ -24,15 +24,31 @@ public:
 
 constexpr size_t NUM_DEF_TYPES = 7UL;
 
-constexpr size_t INT_SIZE = sizeof(int);
-constexpr size_t DOUBLE_SIZE = sizeof(double);
-constexpr size_t BOOL_SIZE = sizeof(bool);
-constexpr size_t STRING_SIZE = INT_SIZE + sizeof(char *);
-constexpr size_t CHAR_SIZE = sizeof(char);
-constexpr size_t NULL_SIZE = 1UL;
-constexpr size_t ARRAY_SIZE = sizeof(char *);
+// By default values are packed onto the stack at their natural
+// widths. With UNIFORM_SLOTS every value takes whole 8 byte slots
+// instead, so every stack access is aligned. The compiler and the
+// runtime must be built with the same setting
+#ifdef UNIFORM_SLOTS
+constexpr size_t SLOT_SIZE = 8UL;
+#else
+constexpr size_t SLOT_SIZE = 1UL;
+#endif
+
+constexpr size_t SlotAligned(size_t bytes)
+{
+    return (bytes + SLOT_SIZE - 1) / SLOT_SIZE * SLOT_SIZE;
+}
+
+constexpr size_t INT_SIZE = SlotAligned(sizeof(int));
+constexpr size_t DOUBLE_SIZE = SlotAligned(sizeof(double));
+constexpr size_t BOOL_SIZE = SlotAligned(sizeof(bool));
+constexpr size_t STRING_SIZE = INT_SIZE + SlotAligned(sizeof(char *));
+constexpr size_t CHAR_SIZE = SlotAligned(sizeof(char));
+constexpr size_t NULL_SIZE = SlotAligned(1UL);
+constexpr size_t ARRAY_SIZE = SlotAligned(sizeof(char *));
 constexpr size_t STRUCT_SIZE = ARRAY_SIZE;
 constexpr size_t PTR_SIZE = STRUCT_SIZE;
+constexpr size_t OPRAND_SIZE = SlotAligned(sizeof(oprand_t));
 
 const std::vector<TypeData> AllTypes{VOID_TYPE, INT_TYPE, DOUBLE_TYPE, BOOL_TYPE, STRING_TYPE, CHAR_TYPE, NULL_TYPE};
 
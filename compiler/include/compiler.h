@@ -1,5 +1,6 @@
 #pragma once
 #include "function.h"
+#include "globalrefs.h"
 #include "idstructs.h"
 #include "libfuncdef.h"
 #include "perror.h"
@@ -22,8 +23,18 @@ public:
 
     std::vector<LibraryFunctionDef> lib_funcs;
 
+    // the globals segment as the program starts, laid out by the
+    // symbol table. Globals initialised with a literal are written
+    // in here, the rest are zeroed for function 0 to assign to
+    std::vector<char> global_data;
+    GlobalRefs global_refs;
+
     std::stack<std::vector<size_t>> break_indices;
     std::vector<ThrowInfo> throw_stack;
+    // how many try clauses are being compiled, calls inside
+    // one are never tail calls as the frame they would replace
+    // is the one the VM unwinds to
+    size_t try_depth = 0;
 
     SymbolTable symbols;
 
@@ -35,7 +46,13 @@ public:
     std::pair<std::vector<Op> *, size_t> cur_routine;
     Compiler();
 
+    // appends the op, tracking the depth of the stack
+    // through it for ops with a fixed stack effect
     void AddCode(Op o);
+    size_t StackDepth();
+    // for ops whose effect depends on the types involved,
+    // sets the depth once the op has been emitted
+    void SetStackDepth(long depth);
     size_t CodeSize();
     // returns the index of the routine and the
     // index within the current routine of the
@@ -63,6 +80,10 @@ public:
     static void SerialiseProgram(Compiler &prog, std::string fPath);
 
 private:
+    // bytes on the stack in the current function's frame, signed
+    // so that an unbalanced pop shows up rather than wrapping
+    long stack_depth = 0;
+
     static void SerialisationError(std::string err);
     static bool DoesFileExist(std::string &path);
     static void SerialiseFunction(Function &f, std::ofstream &file);
@@ -74,4 +95,6 @@ private:
     static void SerialiseStrings(Function &f, std::ofstream &file);
     static void SerialiseOps(Function &f, std::ofstream &file);
     static void SerialiseThrowInfo(std::vector<ThrowInfo> &infos, std::ofstream &file);
+    static void SerialiseGlobals(std::vector<char> &data, std::ofstream &file);
+    static void SerialiseGlobalRefs(GlobalRefs &refs, std::ofstream &file);
 };
\ No newline at end of file
@@ -1,4 +1,5 @@
 #pragma once
+#include "natives.h"
 #include <string>
 #include <vector>
 
@@ -8,9 +9,7 @@
 // };
 
 const std::vector<std::string> NativeFunctions{
-    "void Print(int)",
-    "void Print(double)",
-    "void Print(bool)",
-    "void Print(string)",
-    "void Print(char)",
-    "int Length(string)"};
\ No newline at end of file
+#define x(impl, signature) signature,
+    NATIVES(x)
+#undef x
+};
\ No newline at end of file
@@ -16,6 +16,9 @@ namespace NodeCompiler
     void CompileVarReference(VarReference *vr, Compiler &c);
     void CompileFunctionCall(FunctionCall *fc, Compiler &c);
     void CompileArrayIndex(ArrayIndex *ai, Compiler &c);
+    // true if ai's index is proved to be within its array, which is
+    // then indexed without a bounds check
+    bool IsIndexInRange(ArrayIndex *ai, Compiler &c);
     void CompileBracedInitialiser(BracedInitialiser *ia, Compiler &c);
     void CompileDynamicAllocArray(DynamicAllocArray *da, Compiler &c);
     void CompileFieldAccess(FieldAccess *fa, Compiler &c);
@@ -25,6 +28,7 @@ namespace NodeCompiler
     // statement compiling
     void CompileExprStmt(ExprStmt *es, Compiler &c);
     void CompileDeclaredVar(DeclaredVar *dv, Compiler &c);
+    void CompileGlobalVar(DeclaredVar *dv, Compiler &c);
     void CompileBlock(Block *b, Compiler &c);
     void CompileIfStmt(IfStmt *i, Compiler &c);
     void CompileWhileStmt(WhileStmt *ws, Compiler &c);
@@ -1,38 +1,32 @@
 #include "libmath.h"
 
-extern "C" Object *Sin(VM *vm, Object **args)
+extern "C" void Sin(char *args, char *ret)
 {
-    Object *obj = vm->NewDouble(sin(GetDouble(args[0])));
-    return obj;
+    *(double *)ret = sin(*(double *)args);
 }
 
-extern "C" Object *Cos(VM *vm, Object **args)
+extern "C" void Cos(char *args, char *ret)
 {
-    Object *obj = vm->NewDouble(cos(GetDouble(args[0])));
-    return obj;
+    *(double *)ret = cos(*(double *)args);
 }
 
-extern "C" Object *Tan(VM *vm, Object **args)
+extern "C" void Tan(char *args, char *ret)
 {
-    Object *obj = vm->NewDouble(tan(GetDouble(args[0])));
-    return obj;
+    *(double *)ret = tan(*(double *)args);
 }
 
-extern "C" Object *GetPi(VM *vm, Object **)
+extern "C" void GetPi(char *, char *ret)
 {
-    Object *obj = vm->NewDouble(3.1415926535);
-    return obj;
+    *(double *)ret = 3.1415926535;
 }
 
-extern "C" Object *DoNothing(VM *vm, Object **args)
+extern "C" void DoNothing(char *, char *)
 {
-    return nullptr;
 }
 
-extern "C" Object *EuclideanDist(VM *vm, Object **args)
+extern "C" void EuclideanDist(char *args, char *ret)
 {
-    double x = GetDouble(args[0]);
-    double y = GetDouble(args[1]);
-    Object *obj = vm->NewDouble(fabs(y - x));
-    return obj;
+    double x = *(double *)args;
+    double y = *(double *)(args + DOUBLE_SIZE);
+    *(double *)ret = fabs(y - x);
 }
\ No newline at end of file
@@ -1,5 +1,4 @@
-#include "../include/runtimeobject.h"
-#include "../include/vm.h"
+#include "../../common/typedata.h"
 #include <cmath>
 
 extern "C" constexpr const char *LibraryFunctions[]{"Sin                : double - double",
@@ -11,9 +10,12 @@ extern "C" constexpr const char *LibraryFunctions[]{"Sin                : double
 
 extern "C" constexpr size_t NumLibFunctions{6};
 
-extern "C" Object *Sin(VM *vm, Object **args);
-extern "C" Object *Cos(VM *vm, Object **args);
-extern "C" Object *Tan(VM *vm, Object **args);
-extern "C" Object *GetPi(VM *vm, Object **args);
-extern "C" Object *DoNothing(VM *vm, Object **args);
-extern "C" Object *EuclideanDist(VM *vm, Object **args);
\ No newline at end of file
+// args points at the arguments as they are laid out on the stack and
+// ret is where the result goes - the same address, so read every
+// argument before writing the result
+extern "C" void Sin(char *args, char *ret);
+extern "C" void Cos(char *args, char *ret);
+extern "C" void Tan(char *args, char *ret);
+extern "C" void GetPi(char *args, char *ret);
+extern "C" void DoNothing(char *args, char *ret);
+extern "C" void EuclideanDist(char *args, char *ret);
\ No newline at end of file
@@ -2,15 +2,15 @@
 
 static std::chrono::_V2::system_clock::time_point last;
 
-extern "C" Object *StartTime(VM *vm, Object **obj)
+extern "C" void StartTime(char *, char *ret)
 {
     last = std::chrono::system_clock::now();
-    return vm->NewInt(0);
+    *(int *)ret = 0;
 }
 
-extern "C" Object *EndTime(VM *vm, Object **obj)
+extern "C" void EndTime(char *, char *ret)
 {
     auto now = std::chrono::system_clock::now();
     auto diff = std::chrono::duration_cast<std::chrono::milliseconds>(now - last);
-    return vm->NewInt(diff.count());
+    *(int *)ret = diff.count();
 }
\ No newline at end of file
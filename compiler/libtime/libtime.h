@@ -1,8 +1,10 @@
-#include "runtimeobject.h"
-#include "vm.h"
 #include <chrono>
+#include <cstddef>
 
 extern "C" constexpr const char *LibraryFunctions[]{"StartTime                : - int",
                                                     "EndTime                  : - int"};
 
 extern "C" constexpr size_t NumLibFunctions{2};
+
+extern "C" void StartTime(char *args, char *ret);
+extern "C" void EndTime(char *args, char *ret);
@@ -1,4 +1,5 @@
 #include "compiler.h"
+#include <cassert>
 
 Compiler::Compiler()
 {
@@ -42,9 +43,131 @@ void Compiler::CompileError(Token loc, std::string err)
     throw Error(out.str());
 }
 
+// bytes pushed less bytes popped by the ops whose stack
+// effect is fixed, the rest are accounted for by the
+// NodeCompiler with SetStackDepth
+static long StackEffect(const Op &o)
+{
+    constexpr long INT = INT_SIZE, DOUBLE = DOUBLE_SIZE, BOOL = BOOL_SIZE;
+
+    switch (o.code)
+    {
+    case Opcode::POP:
+        return -static_cast<long>(o.op);
+    case Opcode::LOAD_INT:
+    case Opcode::GET_INT:
+    case Opcode::GET_INT_GLOBAL:
+        return INT;
+    case Opcode::LOAD_DOUBLE:
+    case Opcode::GET_DOUBLE:
+    case Opcode::GET_DOUBLE_GLOBAL:
+        return DOUBLE;
+    case Opcode::LOAD_BOOL:
+    case Opcode::GET_BOOL:
+    case Opcode::GET_BOOL_GLOBAL:
+        return BOOL;
+    case Opcode::LOAD_STRING:
+    case Opcode::GET_STRING:
+    case Opcode::GET_STRING_GLOBAL:
+        return STRING_SIZE;
+    case Opcode::LOAD_CHAR:
+    case Opcode::GET_CHAR:
+    case Opcode::GET_CHAR_GLOBAL:
+        return CHAR_SIZE;
+    case Opcode::GET_ARRAY:
+    case Opcode::GET_ARRAY_GLOBAL:
+        return ARRAY_SIZE;
+    case Opcode::GET_STRUCT:
+    case Opcode::GET_STRUCT_GLOBAL:
+        return STRUCT_SIZE;
+    case Opcode::PUSH:
+        return OPRAND_SIZE;
+    case Opcode::PUSH_SP_OFFSET:
+        return PTR_SIZE;
+    case Opcode::GOTO_LABEL_IF_FALSE:
+        return -BOOL;
+    // a non-zero oprand makes these a unary negation
+    case Opcode::I_SUB:
+        return o.op == 0 ? -INT : 0;
+    case Opcode::D_SUB:
+        return o.op == 0 ? -DOUBLE : 0;
+    case Opcode::I_ADD:
+    case Opcode::I_MUL:
+    case Opcode::I_DIV:
+    case Opcode::DI_ADD:
+    case Opcode::DI_SUB:
+    case Opcode::DI_MUL:
+    case Opcode::DI_DIV:
+    case Opcode::ID_ADD:
+    case Opcode::ID_SUB:
+    case Opcode::ID_MUL:
+    case Opcode::ID_DIV:
+        return -INT;
+    case Opcode::D_ADD:
+    case Opcode::D_MUL:
+    case Opcode::D_DIV:
+        return -DOUBLE;
+    case Opcode::S_ADD:
+        return -static_cast<long>(STRING_SIZE);
+    case Opcode::I_GT:
+    case Opcode::I_LT:
+    case Opcode::I_GEQ:
+    case Opcode::I_LEQ:
+    case Opcode::I_EQ_EQ:
+    case Opcode::I_BANG_EQ:
+        return BOOL - 2 * INT;
+    case Opcode::DI_GT:
+    case Opcode::DI_LT:
+    case Opcode::DI_GEQ:
+    case Opcode::DI_LEQ:
+    case Opcode::DI_EQ_EQ:
+    case Opcode::DI_BANG_EQ:
+    case Opcode::ID_GT:
+    case Opcode::ID_LT:
+    case Opcode::ID_GEQ:
+    case Opcode::ID_LEQ:
+    case Opcode::ID_EQ_EQ:
+    case Opcode::ID_BANG_EQ:
+        return BOOL - INT - DOUBLE;
+    case Opcode::D_GT:
+    case Opcode::D_LT:
+    case Opcode::D_GEQ:
+    case Opcode::D_LEQ:
+    case Opcode::D_EQ_EQ:
+    case Opcode::D_BANG_EQ:
+        return BOOL - 2 * DOUBLE;
+    case Opcode::B_EQ_EQ:
+    case Opcode::B_BANG_EQ:
+    case Opcode::B_AND_AND:
+    case Opcode::B_OR_OR:
+        return -BOOL;
+    default:
+        return 0;
+    }
+}
+
 void Compiler::AddCode(Op o)
 {
     cur_routine.first->push_back(o);
+    SetStackDepth(stack_depth + StackEffect(o));
+}
+
+size_t Compiler::StackDepth()
+{
+    return static_cast<size_t>(stack_depth);
+}
+
+void Compiler::SetStackDepth(long depth)
+{
+    // popping more than was pushed is a bug in the NodeCompiler
+    assert(depth >= 0);
+    stack_depth = depth;
+    if (stack_depth > cur->max_stack)
+    {
+        if (static_cast<size_t>(stack_depth) > MAX_OPRAND)
+            throw Error("[COMPILE ERROR] Function uses more than " + std::to_string(MAX_OPRAND) + " bytes of stack");
+        cur->max_stack = static_cast<oprand_t>(stack_depth);
+    }
 }
 
 size_t Compiler::CodeSize()
@@ -83,6 +206,7 @@ void Compiler::AddFunction()
     functions.push_back(Function());
     cur = &functions.back();
     cur_routine = {&cur->routines.back(), cur->routines.size() - 1};
+    stack_depth = 0;
 }
 
 size_t Compiler::GetVariableStackLoc(std::string &name)
@@ -122,6 +246,8 @@ void Compiler::Disassemble()
         std::cout << "Function index: " << i << std::endl
                   << "Function arity: " << +functions[i].arity
                   << std::endl
+                  << "Function max stack: " << +functions[i].max_stack
+                  << std::endl
                   << std::endl;
 
         functions[i].PrintCode();
@@ -142,7 +268,7 @@ void Compiler::ClearCurrentDepthWithPOPInst()
     {
         size_t varSize = symbols.vars.back().size;
         symbols.ReduceSP(varSize);
-        AddCode({Opcode::POP, varSize});
+        AddCode({Opcode::POP, static_cast<oprand_t>(varSize)});
         symbols.vars.pop_back();
         count++;
     }
@@ -160,6 +286,10 @@ void Compiler::SerialiseProgram(Compiler &prog, std::string fPath)
     // serialising the index of the 'void Main()' function
     file.write((char *)&prog.main_index, sizeof(prog.main_index));
 
+    // the stack layout the offsets in the code were computed for
+    oprand_t slot_size = static_cast<oprand_t>(SLOT_SIZE);
+    file.write((char *)&slot_size, sizeof(slot_size));
+
     // serialising the number of functions
     oprand_t numFunctions = static_cast<oprand_t>(prog.functions.size());
     file.write((char *)&numFunctions, sizeof(numFunctions));
@@ -206,9 +336,13 @@ void Compiler::SerialiseProgram(Compiler &prog, std::string fPath)
 
         // writing the arity of the library function
         file.write((char *)&lib_func.arity, sizeof(lib_func.arity));
+        file.write((char *)&lib_func.arg_size, sizeof(lib_func.arg_size));
+        file.write((char *)&lib_func.ret_size, sizeof(lib_func.ret_size));
     }
 
     SerialiseThrowInfo(prog.throw_stack, file);
+    SerialiseGlobals(prog.global_data, file);
+    SerialiseGlobalRefs(prog.global_refs, file);
     file.close();
 }
 
@@ -227,6 +361,8 @@ void Compiler::SerialiseFunction(Function &f, std::ofstream &file)
 {
     // write arity
     file.write((char *)&f.arity, sizeof(f.arity));
+    file.write((char *)&f.arg_size, sizeof(f.arg_size));
+    file.write((char *)&f.max_stack, sizeof(f.max_stack));
 
     // write constants and code
     SerialiseInts(f, file);
@@ -297,7 +433,7 @@ void Compiler::SerialiseOps(Function &f, std::ofstream &file)
         {
             op_t code_as_num = static_cast<op_t>(op.code);
             file.write((char *)&code_as_num, sizeof(code_as_num));
-            file.write((char *)&op.op, sizeof(op.op));
+            WriteVarint(op.op, file);
         }
     }
 }
@@ -314,6 +450,23 @@ void Compiler::SerialiseThrowInfo(std::vector<ThrowInfo> &infos, std::ofstream &
         file.write((char *)&ti.is_array, sizeof(ti.is_array));
         file.write((char *)&ti.type, sizeof(ti.type));
         file.write((char *)&ti.func, sizeof(ti.func));
+        file.write((char *)&ti.begin, sizeof(ti.begin));
+        file.write((char *)&ti.end, sizeof(ti.end));
         file.write((char *)&ti.index, sizeof(ti.index));
+        file.write((char *)&ti.var_loc, sizeof(ti.var_loc));
+        file.write((char *)&ti.var_size, sizeof(ti.var_size));
     }
 }
+
+void Compiler::SerialiseGlobals(std::vector<char> &data, std::ofstream &file)
+{
+    file.write((char *)&GLOBALS_ID, sizeof(GLOBALS_ID));
+    SerialiseData(data.data(), sizeof(char), data.size(), file);
+}
+
+void Compiler::SerialiseGlobalRefs(GlobalRefs &refs, std::ofstream &file)
+{
+    file.write((char *)&GLOBAL_REFS_ID, sizeof(GLOBAL_REFS_ID));
+    SerialiseData(refs.strings.data(), sizeof(oprand_t), refs.strings.size(), file);
+    SerialiseData(refs.pointers.data(), sizeof(oprand_t), refs.pointers.size(), file);
+}
\ No newline at end of file
@@ -1,4 +1,5 @@
 #include "nodecompiler.h"
+#include <cstring>
 
 /*
     TODO
@@ -242,6 +243,7 @@ void NodeCompiler::CompileAssign(Assign *a, Compiler &c)
     3) FieldAccess
     */
 
+    size_t depth = c.StackDepth();
     a->val->NodeCompile(c);
 
     VarReference *target_as_vr = dynamic_cast<VarReference *>(a->target.get());
@@ -262,19 +264,33 @@ void NodeCompiler::CompileAssign(Assign *a, Compiler &c)
     ArrayIndex *target_as_ai = dynamic_cast<ArrayIndex *>(a->target.get());
     if (target_as_ai != nullptr)
     {
-        target_as_ai->name->NodeCompile(c);
         TypeData name = target_as_ai->name->GetType();
-
-        target_as_ai->index->NodeCompile(c);
-
         if (name.is_array)
         {
-            c.AddCode({Opcode::ARR_SET, 0});
-            --name.type;
-            c.AddCode({Opcode::PUSH, c.symbols.SizeOf(name)});
+            target_as_ai->name->NodeCompile(c);
+            target_as_ai->index->NodeCompile(c);
+
+            --name.is_array;
+            c.AddCode({Opcode::PUSH, static_cast<oprand_t>(c.symbols.SizeOf(name))});
+            if (IsIndexInRange(target_as_ai, c))
+                c.AddCode({Opcode::ARR_SET_UNCHECKED, 0});
+            else
+                c.AddCode({Opcode::ARR_SET, 0});
         }
         else
-            c.AddCode({Opcode::STRING_SET, 0});
+        {
+            // strings are values, so the char is set in the
+            // variable itself rather than in a copy of it
+            VarReference *str = dynamic_cast<VarReference *>(target_as_ai->name.get());
+            std::optional<VarID> vid;
+            if (str != nullptr)
+                vid = c.symbols.GetVar(str->name);
+            if (!vid || vid->depth == 0)
+                c.CompileError(target_as_ai->Loc(), "Only the characters of local string variables can be assigned to");
+
+            target_as_ai->index->NodeCompile(c);
+            c.AddCode({Opcode::STRING_SET, static_cast<oprand_t>(c.symbols.GetVariableStackLoc(str->name))});
+        }
     }
 
     FieldAccess *target_as_fa = dynamic_cast<FieldAccess *>(a->target.get());
@@ -294,6 +310,9 @@ void NodeCompiler::CompileAssign(Assign *a, Compiler &c)
 
         c.AddCode({Opcode::STRUCT_MEMBER_SET, static_cast<oprand_t>(offset)});
     }
+
+    // the assigned value is left on the stack
+    c.SetStackDepth(depth + c.symbols.SizeOf(a->val->GetType()));
 }
 
 void NodeCompiler::CompileVarReference(VarReference *vr, Compiler &c)
@@ -316,6 +335,7 @@ void NodeCompiler::CompileFunctionCall(FunctionCall *fc, Compiler &c)
         args.push_back(e->GetType());
 
     std::optional<FuncID> fid = c.symbols.GetFunc(fc->name, args);
+    size_t depth = c.StackDepth();
 
     ERROR_GUARD(
         {
@@ -352,19 +372,34 @@ void NodeCompiler::CompileFunctionCall(FunctionCall *fc, Compiler &c)
         if (func_num > MAX_OPRAND - 1)
             c.CompileError(fc->Loc(), "Too many C library functions, maximum number is " + std::to_string(MAX_OPRAND));
 
-        size_t arg_size = 0;
-        for (const auto &type : args)
-            arg_size += c.symbols.SizeOf(type);
+        // printing is an op of its own rather than a native call
+        if (fc->name == "Print")
+        {
+            c.AddCode({Opcode::PRINT, args[0].type});
+            break;
+        }
 
-        c.AddCode({Opcode::PUSH, static_cast<oprand_t>(arg_size)});
+        // the runtime knows each native's argument size
         c.AddCode({Opcode::NATIVE_CALL, static_cast<oprand_t>(func_num)});
         break;
     }
     }
+
+    // the arguments are replaced by the return value
+    TypeData ret = fc->GetType();
+    c.SetStackDepth(depth + (ret == VOID_TYPE ? 0 : c.symbols.SizeOf(ret)));
+}
+
+bool NodeCompiler::IsIndexInRange(ArrayIndex *, Compiler &)
+{
+    // nothing tracks array lengths or index ranges yet,
+    // so every index is checked at runtime
+    return false;
 }
 
 void NodeCompiler::CompileArrayIndex(ArrayIndex *ai, Compiler &c)
 {
+    size_t depth = c.StackDepth();
     ai->name->NodeCompile(c);
     TypeData name = ai->name->GetType();
     ai->index->NodeCompile(c);
@@ -373,11 +408,16 @@ void NodeCompiler::CompileArrayIndex(ArrayIndex *ai, Compiler &c)
     {
         --name.is_array;
         size_t element_size = c.symbols.SizeOf(name);
-        c.AddCode({Opcode::PUSH, element_size});
-        c.AddCode({Opcode::ARR_INDEX, 0});
+        c.AddCode({Opcode::PUSH, static_cast<oprand_t>(element_size)});
+        if (IsIndexInRange(ai, c))
+            c.AddCode({Opcode::ARR_INDEX_UNCHECKED, 0});
+        else
+            c.AddCode({Opcode::ARR_INDEX, 0});
     }
     else
         c.AddCode({Opcode::STRING_INDEX, 0});
+
+    c.SetStackDepth(depth + c.symbols.SizeOf(ai->GetType()));
 }
 
 void NodeCompiler::CompileBracedInitialiser(BracedInitialiser *bi, Compiler &c)
@@ -397,17 +437,24 @@ void NodeCompiler::CompileBracedInitialiser(BracedInitialiser *bi, Compiler &c)
 
 void NodeCompiler::CompileDynamicAllocArray(DynamicAllocArray *da, Compiler &c)
 {
+    size_t depth = c.StackDepth();
     da->size->NodeCompile(c);
     TypeData element_type = da->GetType();
     element_type.is_array--;
     size_t elementSize = c.symbols.SizeOf(element_type);
     c.AddCode({Opcode::PUSH, static_cast<oprand_t>(elementSize)});
-    c.AddCode({Opcode::ARR_ALLOC, 0});
+
+    // the collector only scans arrays whose elements can refer to
+    // other objects
+    bool holds_refs = element_type.is_array || element_type == STRING_TYPE || element_type.type >= NUM_DEF_TYPES;
+    c.AddCode({Opcode::ARR_ALLOC, holds_refs});
+    c.SetStackDepth(depth + ARRAY_SIZE);
     c.symbols.UpdateSP(ARRAY_SIZE);
 }
 
 void NodeCompiler::CompileFieldAccess(FieldAccess *fa, Compiler &c)
 {
+    size_t depth = c.StackDepth();
     fa->accessor->NodeCompile(c);
     TypeData accessor = fa->accessor->GetType();
 
@@ -424,12 +471,15 @@ void NodeCompiler::CompileFieldAccess(FieldAccess *fa, Compiler &c)
     }
 
     c.AddCode({Opcode::STRUCT_MEMBER, static_cast<oprand_t>(offset)});
+    c.SetStackDepth(depth + c.symbols.SizeOf(fa->GetType()));
 }
 
 void NodeCompiler::CompileTypeCast(TypeCast *tc, Compiler &c)
 {
+    size_t depth = c.StackDepth();
     tc->arg->NodeCompile(c);
     c.AddCode({Opcode::CAST, tc->t.type});
+    c.SetStackDepth(depth + c.symbols.SizeOf(tc->t));
 }
 
 void NodeCompiler::CompileSequence(Sequence *, Compiler &)
@@ -449,24 +499,108 @@ void NodeCompiler::CompileExprStmt(ExprStmt *es, Compiler &c)
     es->exp->NodeCompile(c);
     TypeData exp = es->exp->GetType();
     if (exp != VOID_TYPE)
-        c.AddCode({Opcode::POP, c.symbols.SizeOf(exp)});
+        c.AddCode({Opcode::POP, static_cast<oprand_t>(c.symbols.SizeOf(exp))});
+}
+
+// pushes what a local declared without an initialiser holds: 0,
+// false, '\0', an empty string or a null reference. It still takes
+// its bytes on the stack, so the locals after it are where the
+// symbol table puts them and popping it pops what was pushed
+static void CompileZeroValue(DeclaredVar *dv, Compiler &c)
+{
+    TypeData t = dv->t;
+    if (t.is_array || t.type >= NUM_DEF_TYPES)
+    {
+        for (size_t pushed = 0; pushed < PTR_SIZE; pushed += OPRAND_SIZE)
+            c.AddCode({Opcode::PUSH, 0});
+        c.symbols.UpdateSP(PTR_SIZE);
+        return;
+    }
+
+    Token zero(TokenID::INT_L, "0", dv->Loc().line);
+    if (t == DOUBLE_TYPE)
+        zero = Token(TokenID::DOUBLE_L, "0", zero.line);
+    else if (t == BOOL_TYPE)
+        zero = Token(TokenID::BOOL_L, "false", zero.line);
+    else if (t == STRING_TYPE)
+        zero = Token(TokenID::STRING_L, "", zero.line);
+    else if (t == CHAR_TYPE)
+        zero = Token(TokenID::CHAR_L, "", zero.line);
+
+    Literal l(zero);
+    NodeCompiler::CompileLiteral(&l, c);
 }
 
 void NodeCompiler::CompileDeclaredVar(DeclaredVar *dv, Compiler &c)
 {
-    size_t size = 0;
+    if (c.symbols.depth == 0)
+    {
+        CompileGlobalVar(dv, c);
+        return;
+    }
+
+    size_t beginning = c.symbols.GetCurOffset();
     if (dv->value != nullptr)
+        dv->value->NodeCompile(c);
+    else
+        CompileZeroValue(dv, c);
+    size_t size = c.symbols.GetCurOffset() - beginning;
+    c.symbols.AddVar(dv->t, dv->name, size);
+}
+
+// Globals live in the globals segment rather than on the stack. One
+// initialised with a literal of its own type is written straight into
+// the data section, so it costs nothing at startup, and the rest are
+// assigned to by function 0 before it calls Main. One with no
+// initialiser is left as the zeroed bytes of the data section
+void NodeCompiler::CompileGlobalVar(DeclaredVar *dv, Compiler &c)
+{
+    Literal *l = dynamic_cast<Literal *>(dv->value.get());
+    bool in_data = dv->value == nullptr || (l != nullptr && l->t == dv->t && dv->t != STRING_TYPE);
+
+    if (!in_data)
     {
-        size_t beginning = c.symbols.GetCurOffset();
+        size_t sp = c.symbols.GetCurOffset();
         dv->value->NodeCompile(c);
-        size = c.symbols.GetCurOffset() - beginning;
+        c.symbols.SetSP(sp);
+    }
+
+    size_t size = c.symbols.SizeOf(dv->t);
+    c.symbols.AddVar(dv->t, dv->name, size);
+    size_t loc = c.symbols.GetVariableStackLoc(dv->name);
+    if (loc + size > MAX_OPRAND)
+        c.CompileError(dv->Loc(), "Too many globals, maximum size is " + std::to_string(MAX_OPRAND) + " bytes");
+    c.global_data.resize(loc + size);
+    if (dv->t.is_array || dv->t.type >= NUM_DEF_TYPES)
+        c.global_refs.pointers.push_back(static_cast<oprand_t>(loc));
+    else if (dv->t == STRING_TYPE)
+        c.global_refs.strings.push_back(static_cast<oprand_t>(loc));
+
+    if (!in_data)
+    {
+        c.AddCode({GetAssignInstruction(dv->t, true), static_cast<oprand_t>(loc)});
+        c.AddCode({Opcode::POP, static_cast<oprand_t>(c.symbols.SizeOf(dv->value->GetType()))});
+        return;
+    }
+    if (l == nullptr)
+        return;
 
-        if (c.symbols.depth == 0)
-            c.AddCode({GetAssignInstruction(dv->t, true), 0});
+    std::string literal = l->Loc().literal;
+    char *dest = &c.global_data[loc];
+    if (dv->t == INT_TYPE)
+    {
+        int x = std::stoi(literal);
+        std::memcpy(dest, &x, sizeof(x));
     }
+    else if (dv->t == DOUBLE_TYPE)
+    {
+        double x = std::stod(literal);
+        std::memcpy(dest, &x, sizeof(x));
+    }
+    else if (dv->t == BOOL_TYPE)
+        *(bool *)dest = literal == "true";
     else
-        size = c.symbols.SizeOf(dv->t);
-    c.symbols.AddVar(dv->t, dv->name, size);
+        *dest = literal[0];
 }
 
 void NodeCompiler::CompileBlock(Block *b, Compiler &c)
@@ -568,6 +702,7 @@ void NodeCompiler::CompileWhileStmt(WhileStmt *ws, Compiler &c)
 void NodeCompiler::CompileFuncDecl(FuncDecl *fd, Compiler &c)
 {
     c.cur_func = fd;
+    size_t outer_depth = c.StackDepth();
 
     c.AddFunction();
 
@@ -584,8 +719,17 @@ void NodeCompiler::CompileFuncDecl(FuncDecl *fd, Compiler &c)
     c.symbols.AddFunc(FuncID(fd->ret, fd->name, templates, argtypes, FunctionType::USER_DEFINED, c.parse_index));
 
     c.symbols.depth++;
+    // the arguments are already on the stack when the function is entered
+    size_t arg_size = 0;
     for (auto &arg : fd->params)
+    {
         c.symbols.AddVar(arg.first, arg.second, c.symbols.SizeOf(arg.first));
+        arg_size += c.symbols.SizeOf(arg.first);
+    }
+    if (arg_size > MAX_OPRAND)
+        c.CompileError(fd->Loc(), "Too many arguments, maximum size is " + std::to_string(MAX_OPRAND) + " bytes");
+    c.cur->arg_size = static_cast<oprand_t>(arg_size);
+    c.SetStackDepth(arg_size);
 
     ERROR_GUARD(
         {
@@ -594,9 +738,20 @@ void NodeCompiler::CompileFuncDecl(FuncDecl *fd, Compiler &c)
         },
         c)
 
+    // a call to a void function as the last statement is a tail call,
+    // the locals popped after it go with the frame it replaces
+    ExprStmt *last = fd->body.empty() ? nullptr : dynamic_cast<ExprStmt *>(fd->body.back().get());
+    if (c.try_depth == 0 && last != nullptr && dynamic_cast<FunctionCall *>(last->exp.get()) != nullptr && c.CodeSize() > 0)
+    {
+        std::pair<size_t, size_t> call = c.LastAddedCodeLoc();
+        if (c.cur->routines[call.first][call.second].code == Opcode::CALL_F)
+            c.ModifyOpcodeAt(call, Opcode::TAIL_CALL);
+    }
+
     c.ClearCurrentDepthWithPOPInst();
     c.symbols.depth--;
     c.cur = &c.functions[0];
+    c.SetStackDepth(outer_depth);
 
     c.cur_func = nullptr;
 }
@@ -609,8 +764,18 @@ void NodeCompiler::CompileReturn(Return *r, Compiler &c)
     {
         // TODO - check return type can be assigned to one
         // specified at function declaration
+        size_t depth = c.StackDepth();
         r->ret_val->NodeCompile(c);
-        c.AddCode({Opcode::RETURN, 0});
+
+        // returning the result of a call straight away can reuse this
+        // function's frame for the callee, unless it is in a try clause
+        std::pair<size_t, size_t> last = c.LastAddedCodeLoc();
+        if (c.try_depth == 0 && dynamic_cast<FunctionCall *>(r->ret_val.get()) != nullptr &&
+            c.cur->routines[last.first][last.second].code == Opcode::CALL_F)
+            c.ModifyOpcodeAt(last, Opcode::TAIL_CALL);
+        else
+            c.AddCode({Opcode::RETURN, static_cast<oprand_t>(c.symbols.SizeOf(r->ret_val->GetType()))});
+        c.SetStackDepth(depth);
     }
 }
 
@@ -684,7 +849,12 @@ void NodeCompiler::CompileImportStmt(ImportStmt *is, Compiler &c)
                     if (c.symbols.NumCFuncs() > MAX_OPRAND)
                         c.CompileError(is->Loc(), "Cannot import more than " + std::to_string(MAX_OPRAND) + " library functions in total");
 
-                    c.lib_funcs.push_back(LibraryFunctionDef(func.name, library, func.argtypes.size()));
+                    size_t arg_size = 0;
+                    for (const auto &arg : func.argtypes)
+                        arg_size += c.symbols.SizeOf(arg);
+                    size_t ret_size = func.ret == VOID_TYPE ? 0 : c.symbols.SizeOf(func.ret);
+
+                    c.lib_funcs.push_back(LibraryFunctionDef(func.name, library, func.argtypes.size(), arg_size, ret_size));
                 }
             }
         },
@@ -705,14 +875,22 @@ void NodeCompiler::CompileBreak(Break *b, Compiler &c)
 
 void NodeCompiler::CompileThrow(Throw *t, Compiler &c)
 {
+    size_t depth = c.StackDepth();
     t->exp->NodeCompile(c);
-    c.AddCode({Opcode::THROW, 0});
+
+    TypeData thrown = t->exp->GetType();
+    c.AddCode({Opcode::THROW, ThrowInfo::ThrownType(thrown.is_array, thrown.type)});
+    c.SetStackDepth(depth);
 }
 
+// The try clause gets routines of its own so that once linked its
+// code is one range, which goes in the exception table along with
+// the catch clause's routine. Nothing runs on entry to the try
+// clause, the catch clause is only reached by the VM unwinding to it
 void NodeCompiler::CompileTryCatch(TryCatch *tc, Compiler &c)
 {
     ThrowInfo ti;
-    ti.func = c.cur - &c.functions[0];
+    ti.func = static_cast<oprand_t>(c.cur - &c.functions[0]);
 
     TypeData catch_type = tc->catch_var.first;
     std::string catch_var_name = tc->catch_var.second;
@@ -720,21 +898,54 @@ void NodeCompiler::CompileTryCatch(TryCatch *tc, Compiler &c)
     ti.type = catch_type.type;
     ti.is_array = catch_type.is_array;
 
-    size_t throw_info_size = c.throw_stack.size();
-    if (throw_info_size > MAX_OPRAND)
-        c.CompileError(tc->Loc(), "Too many try-catch blocks, maximum number is " + std::to_string(MAX_OPRAND));
+    size_t depth = c.StackDepth();
 
-    c.AddCode({Opcode::PUSH_THROW_INFO, static_cast<oprand_t>(throw_info_size)});
+    c.AddCode({Opcode::GOTO_LABEL, 0});
+    std::pair<size_t, size_t> to_try = c.LastAddedCodeLoc();
+    c.AddRoutine();
+    size_t try_routine = c.GetCurRoutineIndex();
+
+    c.try_depth++;
     tc->try_clause->NodeCompile(c);
+    c.try_depth--;
+
+    c.AddCode({Opcode::GOTO_LABEL, 0});
+    std::pair<size_t, size_t> try_done = c.LastAddedCodeLoc();
+    c.AddRoutine();
+    size_t catch_routine = c.GetCurRoutineIndex();
+
+    if (catch_routine > MAX_OPRAND)
+        c.CompileError(tc->try_clause->Loc(), "Too many routines");
+    c.ModifyOprandAt(to_try, static_cast<oprand_t>(try_routine));
+
+    ti.begin = static_cast<oprand_t>(try_routine);
+    ti.end = static_cast<oprand_t>(catch_routine);
+    ti.index = static_cast<oprand_t>(catch_routine);
 
-    size_t s_index = c.CodeSize();
-    if (s_index > MAX_OPRAND)
-        c.CompileError(tc->try_clause->Loc(), "Too much code generated from 'try' clause");
+    // the VM leaves the thrown value where the catch variable goes
+    size_t var_size = c.symbols.SizeOf(catch_type);
+    c.symbols.depth++;
+    c.symbols.AddVar(catch_type, catch_var_name, var_size);
+    c.symbols.UpdateSP(var_size);
+    c.SetStackDepth(depth + var_size);
 
-    ti.index = static_cast<oprand_t>(s_index);
+    ti.var_loc = static_cast<oprand_t>(c.symbols.GetVariableStackLoc(catch_var_name));
+    ti.var_size = static_cast<oprand_t>(var_size);
     c.throw_stack.push_back(ti);
-    c.symbols.AddVar(catch_type, catch_var_name, c.symbols.SizeOf(catch_type));
+
     tc->catch_clause->NodeCompile(c);
+    c.ClearCurrentDepthWithPOPInst();
+    c.symbols.depth--;
+
+    c.AddCode({Opcode::GOTO_LABEL, 0});
+    std::pair<size_t, size_t> catch_done = c.LastAddedCodeLoc();
+    c.AddRoutine();
+    size_t after = c.GetCurRoutineIndex();
+
+    if (after > MAX_OPRAND)
+        c.CompileError(tc->catch_clause->Loc(), "Too many routines");
+    c.ModifyOprandAt(try_done, static_cast<oprand_t>(after));
+    c.ModifyOprandAt(catch_done, static_cast<oprand_t>(after));
 }
 
 //-----------------EXPRESSIONS---------------------//
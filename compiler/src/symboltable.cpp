@@ -1,4 +1,5 @@
 #include "symboltable.h"
+#include <algorithm>
 
 bool operator==(const TypeInfo &l, const TypeInfo &r)
 {
@@ -131,17 +132,43 @@ std::optional<VarID> SymbolTable::GetVar(std::string &name)
     return vars[varIndex];
 }
 
+// globals are laid out in the globals segment at their natural
+// alignment, so that each is read with one aligned load
+static size_t GlobalAligned(size_t loc, size_t size)
+{
+    size_t align = std::clamp(size, static_cast<size_t>(1), sizeof(double));
+    return (loc + align - 1) / align * align;
+}
+
+// globals are addressed from the start of the globals segment and
+// locals from the start of their function's frame
 size_t SymbolTable::GetVariableStackLoc(std::string &name)
 {
+    size_t index = SIZE_MAX;
+    for (size_t i = vars.size(); i-- > 0;)
+    {
+        if (vars[i].name == name)
+        {
+            index = i;
+            break;
+        }
+    }
+
+    if (index == SIZE_MAX)
+        return SIZE_MAX;
+
+    bool is_global = vars[index].depth == 0;
     size_t loc = 0;
-    for (const auto &var : vars)
+    for (size_t i = 0; i < index; i++)
     {
-        if (name == var.name)
-            return loc;
-        loc += var.size;
+        if ((vars[i].depth == 0) != is_global)
+            continue;
+        if (is_global)
+            loc = GlobalAligned(loc, vars[i].size);
+        loc += vars[i].size;
     }
 
-    return SIZE_MAX;
+    return is_global ? GlobalAligned(loc, vars[index].size) : loc;
 }
 
 void SymbolTable::AddFunc(const FuncID &func)
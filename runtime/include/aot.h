@@ -0,0 +1,38 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// The interface between the runtime and a program translated ahead of
+// time with -emit-cpp. The generated C++ includes this header, so it
+// must not depend on the rest of the runtime. A module is built with
+//      g++ -O2 -shared -fPIC -I<runtime/include> prog.cpp -o prog.so
+// and run in place of the interpreter with -aot prog.so
+
+// a translated function reads its arguments from args, laid out as
+// they are on the stack, and writes its return value over them
+typedef void (*AotFunc)(char *args);
+
+// what the runtime lends the module
+struct AotHost
+{
+    // runs the native function that NATIVE_CALL would
+    void (*native_call)(uint32_t index, char *args);
+    // translated code recurses on the machine stack, so it is held
+    // to the same depth as the interpreter's call stack
+    size_t max_call_depth;
+    void (*call_stack_overflow)();
+};
+
+struct AotModule
+{
+    uint32_t num_functions;
+    // of the program the module was translated from
+    uint64_t fingerprint;
+    // indexed like the program's functions, nullptr for the
+    // ones left to the interpreter
+    const AotFunc *functions;
+    const uint32_t *ret_sizes;
+};
+
+#define AOT_INIT_SYMBOL "aot_init"
+typedef const AotModule *(*AotInit)(const AotHost *host);
\ No newline at end of file
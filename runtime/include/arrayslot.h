@@ -0,0 +1,22 @@
+#pragma once
+#include <cstddef>
+
+// An array's slot holds a pointer to its first element. The elements
+// are stored contiguously at their stack widths, starting on a cache
+// line, with the header just before them
+#define ARRAY_ALIGN 64U
+
+struct ArrayHeader
+{
+    int length;
+};
+
+inline ArrayHeader *ArrayHeaderOf(char *elements)
+{
+    return (ArrayHeader *)(elements - sizeof(ArrayHeader));
+}
+
+inline int ArrayLength(char *elements)
+{
+    return ArrayHeaderOf(elements)->length;
+}
\ No newline at end of file
@@ -1,14 +1,68 @@
 #pragma once
-#include <cstddef>
+#include "function.h"
+#include <memory>
 
 class CallFrame
 {
 public:
-    size_t ret_index;
-    size_t ret_function;
-    size_t val_stack_min;
-    //TODO - Include routine to return to
+    // where the caller resumes
+    oprand_t ret_index;
+    // the function running in this frame
+    oprand_t function;
+    oprand_t val_stack_min;
+
+    // the function's code and the constant pools the arithmetic
+    // reads, cached so that returns and constant loads do not have
+    // to go through the VM's function list. The frame is kept to
+    // 40 bytes, the rarer constants are still looked up
+    const Op *code;
+    const int *ints;
+    const double *doubles;
 
     CallFrame() = default;
-    CallFrame(size_t _ret_index, size_t _ret_function, size_t _val_stack_min) : ret_index(_ret_index), ret_function(_ret_function), val_stack_min(_val_stack_min){};
+    CallFrame(oprand_t _ret_index, oprand_t _function, oprand_t _val_stack_min, const Function &f)
+        : ret_index(_ret_index), function(_function), val_stack_min(_val_stack_min),
+          code(f.code.data()), ints(f.ints.data()), doubles(f.doubles.data()){};
+};
+
+// The frames live in one block allocated up front, so calls and
+// returns never allocate and a pointer to a frame stays valid for as
+// long as the frame is on the stack
+class CallStack
+{
+    std::unique_ptr<CallFrame[]> frames;
+    size_t capacity;
+    size_t size = 0;
+
+public:
+    CallStack(size_t _capacity) : frames(new CallFrame[_capacity]), capacity(_capacity){};
+
+    // makes room for max frames, dropping any on the stack
+    void SetCapacity(size_t max)
+    {
+        frames.reset(new CallFrame[max]);
+        capacity = max;
+        size = 0;
+    };
+
+    size_t Capacity() const { return capacity; };
+    size_t Size() const { return size; };
+    bool IsFull() const { return size == capacity; };
+
+    CallFrame *Push(const CallFrame &cf)
+    {
+        frames[size] = cf;
+        return &frames[size++];
+    };
+
+    // drops the top frame and returns the one beneath it,
+    // or nullptr once the stack is empty
+    CallFrame *Pop()
+    {
+        size--;
+        return size == 0 ? nullptr : &frames[size - 1];
+    };
+
+    const CallFrame *begin() const { return frames.get(); };
+    const CallFrame *end() const { return frames.get() + size; };
 };
\ No newline at end of file
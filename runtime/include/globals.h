@@ -0,0 +1,59 @@
+#pragma once
+#include "typedata.h"
+#include <cstring>
+#include <memory>
+#include <vector>
+
+// the segment starts on a cache line and is padded out to whole ones
+#define GLOBALS_ALIGN 64U
+
+// The program's global variables, in one fixed block per VM laid out
+// by the compiler, where each global is at its natural alignment.
+// Oprands are offsets from the start of the block, so a global is read
+// with one indexed load however deep the calls are. A VM's block
+// starts as a copy of the program's data section, and as it has whole
+// cache lines to itself, VMs on other threads never share one with it
+class Globals
+{
+    struct alignas(GLOBALS_ALIGN) Line
+    {
+        char bytes[GLOBALS_ALIGN];
+    };
+
+    std::unique_ptr<Line[]> lines;
+    char *data = nullptr;
+    size_t size = 0;
+
+public:
+    Globals() = default;
+    Globals(const std::vector<char> &initial)
+        : lines(new Line[(initial.size() + GLOBALS_ALIGN - 1) / GLOBALS_ALIGN]), size(initial.size())
+    {
+        data = reinterpret_cast<char *>(lines.get());
+        if (size != 0)
+            std::memcpy(data, initial.data(), size);
+    };
+
+    char *GetBegin() { return data; };
+    char *GetEnd() { return data + size; };
+    size_t GetSize() const { return size; };
+
+    int GetInt(const oprand_t index) { return *(int *)&data[index]; };
+    void SetInt(const oprand_t index, const int x) { *(int *)&data[index] = x; };
+
+    double GetDouble(const oprand_t index) { return *(double *)&data[index]; };
+    void SetDouble(const oprand_t index, const double x) { *(double *)&data[index] = x; };
+
+    bool GetBool(const oprand_t index) { return *(bool *)&data[index]; };
+    void SetBool(const oprand_t index, const bool x) { *(bool *)&data[index] = x; };
+
+    char GetChar(const oprand_t index) { return data[index]; };
+    void SetChar(const oprand_t index, const char x) { data[index] = x; };
+
+    // the string itself, so that pushing it copies it inline or not
+    char *GetString(const oprand_t index) { return &data[index]; };
+    void SetString(const oprand_t index, const char *str) { std::memcpy(&data[index], str, STRING_SIZE); };
+
+    char *GetArray(const oprand_t index) { return *(char **)&data[index]; };
+    void SetArray(const oprand_t index, char *arr) { *(char **)&data[index] = arr; };
+};
\ No newline at end of file
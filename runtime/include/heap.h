@@ -0,0 +1,92 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <memory>
+#include <ostream>
+#include <vector>
+
+// bytes allocated before the first collection
+#define GC_DEF_THRESHOLD (1U << 20)
+// the heap may grow to this many times the bytes that survived
+// the last collection before the next one
+#define GC_DEF_GROWTH 2.0
+
+// starts every object
+struct ObjectHeader
+{
+    // of the payload
+    size_t size;
+    // from the start of the object to the payload
+    uint32_t offset;
+    // the distance between the places in the payload that may refer
+    // to other objects, or 0 for payloads that cannot, like a
+    // string's chars, which are then not scanned
+    uint32_t ref_stride;
+    // the payload's, kept so that a snapshot can allocate it again
+    uint32_t align;
+    bool marked;
+};
+
+// a range of bytes scanned for references to objects
+struct RootRange
+{
+    const char *begin;
+    const char *end;
+};
+
+struct GCStats
+{
+    size_t collections = 0;
+    size_t bytes_allocated = 0;
+    size_t bytes_freed = 0;
+    // in seconds
+    double total_pause = 0;
+    double max_pause = 0;
+};
+
+// A non-moving mark-sweep collector for what the running program
+// allocates. The stack is byte packed and untyped, so roots are found
+// conservatively: any run of bytes on it that reads as an address
+// inside an object keeps that object alive, wherever it starts. An
+// object that may refer to others is scanned for them at its stride,
+// as its references are at the start of each element. Collections
+// only happen when allocating, so anything the new object is built
+// from must still be on the stack when it is allocated
+class Heap
+{
+    // each starts with a header, sorted by address
+    // while collecting so that an address can be looked up
+    std::vector<std::unique_ptr<char[]>> objects;
+    size_t heap_bytes = 0;
+    size_t threshold = GC_DEF_THRESHOLD;
+    double growth = GC_DEF_GROWTH;
+    GCStats stats;
+
+    // the object with addr inside it, or nullptr
+    ObjectHeader *Find(const char *addr);
+    // marks every object referred to from [begin, end), reading an
+    // address every stride bytes, and adds those with references of
+    // their own to grey
+    void MarkRange(const char *begin, const char *end, size_t stride, std::vector<ObjectHeader *> &grey);
+
+public:
+    void SetThreshold(size_t bytes) { threshold = bytes; };
+    void SetGrowth(double factor) { growth = factor; };
+
+    bool ShouldCollect(size_t bytes) const { return heap_bytes + bytes > threshold; };
+    // frees every object not reachable from the roots
+    void Collect(std::initializer_list<RootRange> roots);
+    // returns the payload, which is left uninitialised and starts on
+    // a multiple of align. The prefix bytes before it are the
+    // caller's to keep a header in, and are never scanned
+    char *Allocate(size_t size, uint32_t ref_stride, size_t prefix = 0, size_t align = alignof(std::max_align_t));
+
+    // every object, in no particular order
+    std::vector<ObjectHeader *> Objects() const;
+
+    size_t Size() const { return heap_bytes; };
+    const GCStats &Stats() const { return stats; };
+    // run_time is how long the program ran for, in seconds
+    void PrintStats(std::ostream &out, double run_time) const;
+};
\ No newline at end of file
@@ -0,0 +1,76 @@
+#pragma once
+#include "function.h"
+#include "stack.h"
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// number of calls and backward branches into a function
+// before it is compiled to machine code
+#define JIT_THRESHOLD 1000U
+
+// the interpreter state the compiled code runs on
+struct JitContext
+{
+    char *frame;
+    char *top;
+};
+
+// machine code for one function, enterable at any instruction
+struct CompiledFunction
+{
+    uint8_t *code = nullptr;
+    size_t size = 0;
+    std::vector<const uint8_t *> native_at;
+
+    ~CompiledFunction();
+};
+
+// A baseline template compiler from stack bytecode to x86-64. Each
+// supported op is expanded into a fixed sequence of instructions
+// working on the VM's own stack, so execution can move between the
+// compiled code and the interpreter at any instruction. An op the
+// compiler does not handle becomes a side exit, which hands its index
+// back to the interpreter to run it from there
+class JIT
+{
+    std::vector<size_t> hotness;
+    std::vector<std::unique_ptr<CompiledFunction>> compiled;
+
+    // saves the registers the compiled code uses, loads the
+    // context into them and jumps to the instruction
+    typedef uint32_t (*JitEntry)(JitContext *ctx, const uint8_t *target);
+    CompiledFunction entry_stub;
+    JitEntry entry;
+
+    static std::unique_ptr<CompiledFunction> Compile(const Function &f);
+
+public:
+    JIT(size_t num_functions);
+
+    // false if there is no code generator for this machine
+    static bool IsSupported();
+
+    // counts a call or backward branch into function f, returning its
+    // compiled code once it is hot
+    const CompiledFunction *Tick(size_t func, const Function &f)
+    {
+        if (compiled[func] != nullptr)
+            return compiled[func].get();
+        if (++hotness[func] < JIT_THRESHOLD)
+            return nullptr;
+
+        compiled[func] = Compile(f);
+        return compiled[func].get();
+    }
+
+    // runs the compiled code from instruction ip until it reaches one
+    // it cannot run, and returns the index of that instruction
+    size_t Run(const CompiledFunction &cf, Stack &stack, size_t ip)
+    {
+        JitContext ctx{stack.GetFrame(), stack.GetTop()};
+        size_t exit_ip = entry(&ctx, cf.native_at[ip]);
+        stack.SetTop(ctx.top);
+        return exit_ip;
+    }
+};
\ No newline at end of file
@@ -1,23 +1,96 @@
 #pragma once
+#include "natives.h"
 #include "typedata.h"
+#include <cstring>
 #include <iostream>
+#include <type_traits>
+#include <utility>
 
-struct ReturnValue
+// Natives are plain C++ functions, listed in natives.h. A string is
+// passed as a pointer to its slot, as a short one's chars are kept in
+// the slot itself
+void PrintInt(int x);
+void PrintDouble(double x);
+void PrintBool(bool x);
+void PrintString(const char *str);
+void PrintChar(char x);
+int Length(const char *str);
+
+// the stack width of each C++ type a native takes or returns
+template <typename T>
+constexpr oprand_t NativeSize = 0;
+template <>
+constexpr oprand_t NativeSize<int> = INT_SIZE;
+template <>
+constexpr oprand_t NativeSize<double> = DOUBLE_SIZE;
+template <>
+constexpr oprand_t NativeSize<bool> = BOOL_SIZE;
+template <>
+constexpr oprand_t NativeSize<char> = CHAR_SIZE;
+template <>
+constexpr oprand_t NativeSize<const char *> = STRING_SIZE;
+
+template <typename T>
+T ReadNativeArg(char *arg)
 {
-    char *data;
-    size_t size;
+    T x;
+    std::memcpy(&x, arg, sizeof(T));
+    return x;
+}
 
-    ReturnValue(char *_data, const size_t _size) : data(_data), size(_size){};
-};
+template <>
+inline const char *ReadNativeArg<const char *>(char *arg)
+{
+    return arg;
+}
+
+// where the i'th of the arguments starts
+template <typename... Args>
+constexpr oprand_t NativeArgOffset(size_t i)
+{
+    oprand_t sizes[] = {NativeSize<Args>..., 0};
+    oprand_t offset = 0;
+    for (size_t j = 0; j < i; j++)
+        offset += sizes[j];
+    return offset;
+}
 
-bool operator==(const ReturnValue &lhs, const ReturnValue &rhs);
-bool operator!=(const ReturnValue &lhs, const ReturnValue &rhs);
+// Calls native F with its arguments read straight from where they are
+// laid out on the stack, and writes its result over them, so a call
+// never allocates. The argument and result sizes are fixed by F's type
+template <auto F>
+struct NativeTrampoline;
 
-const ReturnValue NULL_RETURN(nullptr, 0);
+template <typename Ret, typename... Args, Ret (*F)(Args...)>
+struct NativeTrampoline<F>
+{
+    static_assert(!std::is_pointer_v<Ret>, "natives cannot return strings");
+
+    static constexpr oprand_t arg_size = (NativeSize<Args> + ... + 0);
+    static constexpr oprand_t ret_size = NativeSize<Ret>;
+
+    template <size_t... I>
+    static void CallWith(char *args, std::index_sequence<I...>)
+    {
+        if constexpr (std::is_void_v<Ret>)
+            F(ReadNativeArg<Args>(args + NativeArgOffset<Args...>(I))...);
+        else
+        {
+            Ret ret = F(ReadNativeArg<Args>(args + NativeArgOffset<Args...>(I))...);
+            std::memcpy(args, &ret, sizeof(Ret));
+        }
+    }
 
-ReturnValue PrintInt(char *x);
-ReturnValue PrintDouble(char *x);
-ReturnValue PrintBool(char *x);
-ReturnValue PrintString(char *x);
-ReturnValue PrintChar(char *x);
-ReturnValue Length(char *x);
\ No newline at end of file
+    static void Call(char *args)
+    {
+        CallWith(args, std::index_sequence_for<Args...>{});
+    }
+};
+
+// indexed by NATIVE_CALL's oprand
+struct NativeFunction
+{
+    void (*call)(char *args);
+    oprand_t arg_size;
+    oprand_t ret_size;
+};
\ No newline at end of file
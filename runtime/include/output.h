@@ -0,0 +1,54 @@
+#pragma once
+#include <cstddef>
+#include <memory>
+#include <string>
+
+#define OUTPUT_BUFFER_SIZE (1U << 16)
+
+enum class FlushPolicy
+{
+    // after every line, the default when writing to a terminal
+    LINE,
+    // whenever the buffer fills, the default otherwise
+    SIZE,
+    // only at exit, with the buffer growing to hold everything
+    EXIT,
+};
+
+// A buffer in front of a file descriptor, written out with write(2)
+// according to its flush policy. Numbers are formatted in place with
+// std::to_chars, so printing never allocates or goes through iostreams
+class Output
+{
+    int fd;
+    FlushPolicy policy;
+    std::unique_ptr<char[]> buf;
+    size_t capacity = OUTPUT_BUFFER_SIZE;
+    size_t used = 0;
+
+    // makes room for n more bytes, flushing or growing the
+    // buffer as the policy allows
+    void MakeRoom(size_t n);
+
+public:
+    Output(int _fd);
+    ~Output() { Flush(); };
+
+    void SetPolicy(FlushPolicy _policy) { policy = _policy; };
+
+    void Write(const char *chars, size_t n);
+    void WriteInt(int x);
+    // formatted as iostreams would by default, to 6 significant figures
+    void WriteDouble(double x);
+    void WriteBool(bool x);
+    void WriteChar(char x);
+    void EndLine();
+
+    void Flush();
+};
+
+// the program's standard output, which the PRINT op and the Print
+// natives share so that their output stays in order. Each thread has
+// a buffer of its own, flushed when the thread exits, so VMs running
+// on different threads never write to the same one
+Output &StdOut();
\ No newline at end of file
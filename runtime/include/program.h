@@ -0,0 +1,76 @@
+#pragma once
+#include "aot.h"
+#include "function.h"
+#include "globalrefs.h"
+#include "libfuncdef.h"
+#include "stringtable.h"
+#include "throwinfo.h"
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// Library functions are passed a pointer to their arguments, laid out
+// as they are on the stack, and one to write their result to. Both are
+// the same address, so the arguments must all be read before the
+// result is written
+typedef void (*LibFunc)(char *args, char *ret);
+
+struct LibraryCall
+{
+    LibFunc func;
+    oprand_t arg_size;
+    oprand_t ret_size;
+};
+
+// Everything loaded from a program that running it only reads. Any
+// number of VMs can share one and run the program at the same time,
+// each with its own stack, call stack and heap, so it is only changed
+// while it is being prepared, before a second VM shares it
+struct Program
+{
+    std::vector<Function> functions;
+    StringTable strings;
+    std::unordered_map<oprand_t, std::unordered_set<oprand_t>> struct_tree;
+    // what each VM's globals segment starts out as
+    std::vector<char> global_data;
+    GlobalRefs global_refs;
+
+    // indexed by CALL_LIBRARY_FUNC's oprand
+    std::vector<LibraryCall> lib_calls;
+    // closed once the last VM running the program is gone
+    std::vector<void *> lib_handles;
+
+    // each function's exception table, innermost try block first,
+    // with offsets into the function's linked code
+    std::vector<std::vector<ThrowInfo>> exception_tables;
+
+    // set when functions were translated ahead of time
+    const AotModule *aot_module = nullptr;
+    // false for a program with no Main to run
+    bool has_main;
+    // set once the code is translated to register instructions
+    bool register_code = false;
+    // of the code as it was loaded, before any translation
+    uint64_t fingerprint;
+
+    Program(std::vector<Function> &functions,
+            oprand_t main_index,
+            std::unordered_map<oprand_t, std::unordered_set<oprand_t>> &struct_tree,
+            std::vector<LibraryFunctionDef> &,
+            std::vector<ThrowInfo> &,
+            const std::vector<char> &global_data = {},
+            const GlobalRefs &global_refs = {});
+    ~Program();
+
+    Program(const Program &) = delete;
+    Program &operator=(const Program &) = delete;
+
+    // in a program with a Main, function 0 ends with the call to it
+    // and the implicit return after that, whatever code it has been
+    // translated to
+    size_t MainCall() const { return functions[0].code.size() - 2; };
+};
+
+// FNV-1a over the code, constants and data section, so a translated module or a
+// snapshot is only ever used with the program it was taken from
+uint64_t ProgramFingerprint(const std::vector<Function> &functions, const std::vector<char> &global_data);
\ No newline at end of file
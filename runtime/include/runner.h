@@ -0,0 +1,24 @@
+#pragma once
+#include "vm.h"
+#include <functional>
+#include <memory>
+
+// Runs the same program many times at once, over a pool of threads.
+// Each run is a VM of its own over the shared program, created, run
+// and destroyed on the thread that takes it, so the threads share
+// nothing they write to. A runtime error in any run still ends the
+// whole process, as it does for a single VM
+class Runner
+{
+    std::shared_ptr<Program> program;
+    size_t num_threads;
+
+public:
+    // with no threads given, one per hardware thread
+    Runner(std::shared_ptr<Program> _program, size_t _num_threads = 0);
+
+    // runs the program count times, and returns once every run has
+    // finished. setup is called on each VM, with the index of its
+    // run, before it starts
+    void Run(size_t count, const std::function<void(VM &, size_t)> &setup = nullptr);
+};
\ No newline at end of file
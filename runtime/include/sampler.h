@@ -0,0 +1,51 @@
+#pragma once
+#include "callstack.h"
+#include <ctime>
+#include <memory>
+#include <ostream>
+#include <string>
+
+// microseconds of CPU time between samples
+#define SAMPLER_DEF_INTERVAL 1000U
+// of the sample buffer, in function indices
+#define SAMPLER_BUFFER_SIZE (1U << 22)
+
+// A statistical profiler for the running program. A SIGPROF timer on
+// the process's CPU time interrupts the interpreter, and the handler copies the function of
+// every frame on the call stack into a buffer allocated up front, so
+// a sample costs a walk of the call stack and nothing else. Samples
+// are only aggregated once the program has finished. Only one
+// sampler can be running at a time
+class Sampler
+{
+    const CallStack &cs;
+    size_t num_functions;
+    unsigned interval;
+    timer_t timer;
+    timespec started;
+    // in seconds, between starting and stopping
+    double cpu_time = 0;
+
+    // each sample is its depth followed by the function
+    // of each frame, outermost first
+    std::unique_ptr<oprand_t[]> buf;
+    size_t used = 0;
+    size_t samples = 0;
+    // samples that did not fit in the buffer
+    size_t dropped = 0;
+
+    static void OnSignal(int);
+    void Record();
+
+public:
+    Sampler(const CallStack &_cs, size_t _num_functions, unsigned _interval = SAMPLER_DEF_INTERVAL);
+    ~Sampler() { Stop(); };
+
+    void Start();
+    void Stop();
+
+    // one line per distinct call stack, as flamegraph.pl reads them
+    void WriteFolded(const std::string &path) const;
+    // the time spent in each function and in its callees
+    void PrintTable(std::ostream &out) const;
+};
\ No newline at end of file
@@ -0,0 +1,40 @@
+#pragma once
+#include <cstdint>
+
+// A snapshot is the state a program's global initialisers leave the
+// VM in: the header, then the globals segment's bytes, then each live
+// object as a SnapshotObject followed by its bytes. The initialisers
+// must leave nothing on the stack. Restoring allocates the objects
+// again and moves the addresses into them or into the string
+// constants by as much as what they point into has. Only the globals
+// the program's GlobalRefs lists and the start of each element of an
+// array that holds references are taken to be addresses. The file is
+// read through mmap, and is only meant for the machine that wrote it
+
+struct SnapshotHeader
+{
+    uint32_t magic;
+    uint32_t reserved;
+    // of the program the snapshot was taken of
+    uint64_t fingerprint;
+    // where the string constants were
+    uint64_t strings_begin;
+    uint64_t strings_size;
+    uint64_t globals_size;
+    uint64_t num_objects;
+};
+
+constexpr uint32_t SNAPSHOT_MAGIC = 0x50414e53;
+
+struct SnapshotObject
+{
+    // where the payload was
+    uint64_t payload;
+    uint64_t size;
+    // the bytes kept from before the payload, which hold the
+    // caller's header
+    uint32_t prefix;
+    uint32_t ref_stride;
+    uint32_t align;
+    uint32_t reserved;
+};
\ No newline at end of file
@@ -1,5 +1,5 @@
 #pragma once
-#include "nativefuncimpl.h"
+#include "stringslot.h"
 #include "typedata.h"
 #include <cstring>
 #include <string>
@@ -13,24 +13,48 @@ class Stack
     char *data;
     oprand_t capacity;
     char *top;
-    oprand_t size;
+    // variables are addressed from the start of the current frame
+    char *frame;
+
+    void Grow(const oprand_t bytes);
 
 public:
     Stack();
     ~Stack();
 
     char *GetTop() { return top; };
-    oprand_t GetSize() { return size; };
-    void ReduceSize(const oprand_t x) { size -= x; };
+    void SetTop(char *_top) { top = _top; };
+    char *GetFrame() { return frame; };
+    char *GetBottom() { return data; };
+    oprand_t GetSize() { return static_cast<oprand_t>(top - data); };
+    oprand_t GetCapacity() { return capacity; };
+
+    // pushes do not check for space, the VM reserves each
+    // function's maximum stack depth when it is called
+    void Reserve(const oprand_t bytes)
+    {
+        if (bytes > capacity - GetSize())
+            Grow(bytes);
+    };
+
+    void SetFrame(const oprand_t base) { frame = data + base; };
+
+    // discards everything from base up, apart from the top
+    // 'keep' bytes which are moved down to start at base
+    void DropFrame(const oprand_t base, const oprand_t keep)
+    {
+        std::memmove(data + base, top - keep, keep);
+        top = data + base + keep;
+    };
 
     int GetInt(const oprand_t index)
     {
-        return *(int *)&data[index];
+        return *(int *)&frame[index];
     };
 
     void SetInt(const oprand_t index, const int x)
     {
-        *(int *)&data[index] = x;
+        *(int *)&frame[index] = x;
     };
 
     int PopInt()
@@ -41,7 +65,7 @@ public:
 
     oprand_t PopOprandT()
     {
-        top -= sizeof(oprand_t);
+        top -= OPRAND_SIZE;
         return *(oprand_t *)top;
     }
 
@@ -54,12 +78,12 @@ public:
 
     double GetDouble(const oprand_t index)
     {
-        return *(double *)&data[index];
+        return *(double *)&frame[index];
     };
 
     void SetDouble(const oprand_t index, const double x)
     {
-        *(double *)&data[index] = x;
+        *(double *)&frame[index] = x;
     };
 
     double PopDouble()
@@ -77,12 +101,12 @@ public:
 
     bool GetBool(const oprand_t index)
     {
-        return *(bool *)&data[index];
+        return *(bool *)&frame[index];
     };
 
     void SetBool(const oprand_t index, const bool x)
     {
-        *(bool *)&data[index] = x;
+        *(bool *)&frame[index] = x;
     };
 
     bool PopBool()
@@ -100,13 +124,13 @@ public:
 
     char *GetString(const oprand_t index)
     {
-        return data + index;
+        return frame + index;
     };
 
-    void SetString(const oprand_t index, char *str, int len)
+    // copies the string at str, inline or not, into a variable
+    void SetString(const oprand_t index, const char *str)
     {
-        *(char **)&data[index] = str;
-        *(int *)&data[index + INT_SIZE] = len;
+        std::memcpy(&frame[index], str, STRING_SIZE);
     };
 
     char *PopString()
@@ -124,12 +148,12 @@ public:
 
     char GetChar(const oprand_t index)
     {
-        return *(char *)&data[index];
+        return *(char *)&frame[index];
     };
 
     void SetChar(const oprand_t index, char x)
     {
-        *(char *)&data[index] = x;
+        *(char *)&frame[index] = x;
     }
 
     char PopChar()
@@ -142,17 +166,17 @@ public:
     {
         char *copy = top;
         copy -= CHAR_SIZE;
-        return *(char *)top;
+        return *(char *)copy;
     };
 
     char *GetStruct(const oprand_t index)
     {
-        return data + index;
+        return frame + index;
     };
 
     void SetStruct(const oprand_t index, char *strct)
     {
-        *(char **)&data[index] = strct;
+        *(char **)&frame[index] = strct;
     }
 
     char *PopStruct()
@@ -168,6 +192,29 @@ public:
         return *(char **)copy;
     };
 
+    char *GetArray(const oprand_t index)
+    {
+        return *(char **)&frame[index];
+    };
+
+    void SetArray(const oprand_t index, char *arr)
+    {
+        *(char **)&frame[index] = arr;
+    }
+
+    char *PopArray()
+    {
+        top -= ARRAY_SIZE;
+        return *(char **)top;
+    };
+
+    char *PeekArray()
+    {
+        char *copy = top;
+        copy -= ARRAY_SIZE;
+        return *(char **)copy;
+    };
+
     char *PopPtr()
     {
         top -= STRUCT_SIZE;
@@ -179,90 +226,84 @@ public:
         return top - STRUCT_SIZE;
     };
 
-    void GrowIfUnableToPush(const oprand_t bytes);
-
     void PushInt(const int x)
     {
-        GrowIfUnableToPush(INT_SIZE);
         *(int *)top = x;
         top += INT_SIZE;
     };
 
+    // zero extended to the slot, so that a run of PUSH 0s makes up
+    // a null reference whatever the slot width
     void PushOprandT(const oprand_t x)
     {
-        GrowIfUnableToPush(sizeof(oprand_t));
-        *(oprand_t *)top = x;
-        top += sizeof(oprand_t);
+        if constexpr (OPRAND_SIZE > sizeof(oprand_t))
+            *(uint64_t *)top = x;
+        else
+            *(oprand_t *)top = x;
+        top += OPRAND_SIZE;
     }
 
     void PushDouble(const double x)
     {
-        GrowIfUnableToPush(DOUBLE_SIZE);
         *(double *)top = x;
         top += DOUBLE_SIZE;
     };
 
     void PushBool(const bool x)
     {
-        GrowIfUnableToPush(BOOL_SIZE);
         *(bool *)top = x;
         top += BOOL_SIZE;
     };
 
-    void PushString(const std::string &x)
+    void PushString(char *chars, int len)
     {
-        int len = x.length();
-        char *str = new char[len];
-
-        std::memcpy(str, x.data(), len);
-        GrowIfUnableToPush(PTR_SIZE);
-        *(char **)top = str;
-        top += PTR_SIZE;
-
-        PushInt(len);
-    };
+        WriteString(top, chars, len);
+        top += STRING_SIZE;
+    }
 
-    void PushString(char *str, int len)
+    // pushes a copy of the string at str, inline or not
+    void PushString(const char *str)
     {
-        GrowIfUnableToPush(STRING_SIZE);
-        *(char **)top = str;
-        PushInt(len);
+        std::memcpy(top, str, STRING_SIZE);
+        top += STRING_SIZE;
     }
 
     void PushChar(const char x)
     {
-        GrowIfUnableToPush(CHAR_SIZE);
         *(char *)top = x;
         top += CHAR_SIZE;
     };
 
     void PushArray(char *x)
     {
-        GrowIfUnableToPush(ARRAY_SIZE);
         *(char **)top = x;
         top += ARRAY_SIZE;
     };
 
     void PushStruct(char *x)
     {
-        GrowIfUnableToPush(STRUCT_SIZE);
         *(char **)top = x;
         top += STRUCT_SIZE;
     };
 
     void PushPtr(char *x)
     {
-        GrowIfUnableToPush(ARRAY_SIZE);
         *(char **)top = x;
         top += ARRAY_SIZE;
     };
 
-    void PushReturnValue(const ReturnValue &ret)
+    // for values whose size is only known at runtime, like elements
+    void PushBytes(const char *src, const oprand_t n)
     {
-        GrowIfUnableToPush(ret.size);
-        std::memcpy(top, ret.data, ret.size);
-        delete[] ret.data;
-    }
+        std::memcpy(top, src, n);
+        top += n;
+    };
+
+    // for calls that write their result over their arguments
+    void ReplaceTop(const oprand_t popped, const oprand_t pushed)
+    {
+        top = top - popped + pushed;
+    };
 
     void PopBytes(const oprand_t n)
     {
@@ -0,0 +1,60 @@
+#pragma once
+#include "typedata.h"
+#include <climits>
+#include <cstring>
+
+// A string on the stack is a pointer to its chars followed by its
+// length. A string short enough to fit in the pointer's bytes is kept
+// there instead, with STRING_INLINE set in the length, so short
+// strings are never allocated and are read without chasing a pointer
+constexpr int STRING_INLINE = INT_MIN;
+constexpr int INLINE_STRING_CAPACITY = static_cast<int>(PTR_SIZE);
+
+inline bool IsInlineString(const char *str)
+{
+    return (*(const int *)(str + PTR_SIZE) & STRING_INLINE) != 0;
+}
+
+inline int StringLength(const char *str)
+{
+    return *(const int *)(str + PTR_SIZE) & ~STRING_INLINE;
+}
+
+// points into the string itself when it is inline, so it is only
+// valid for as long as the string stays where it is
+inline const char *StringChars(const char *str)
+{
+    return IsInlineString(str) ? str : *(char *const *)str;
+}
+
+// Strings built at runtime that are too long to inline live in heap
+// buffers with room to grow. Strings only hold a view of the first
+// len chars of a buffer, and nothing ever changes chars that are in
+// use, so when a concatenation's left side is the whole of the buffer
+// in use its right side can be appended in place. Building a string
+// with 's = s + x' is then linear rather than quadratic
+struct StringBuffer
+{
+    int capacity;
+    int used;
+};
+
+inline StringBuffer *BufferOf(char *chars)
+{
+    return (StringBuffer *)(chars - sizeof(StringBuffer));
+}
+
+// chars is only kept when the string is too long to inline
+inline void WriteString(char *str, char *chars, int len)
+{
+    if (len <= INLINE_STRING_CAPACITY)
+    {
+        std::memmove(str, chars, len);
+        *(int *)(str + PTR_SIZE) = len | STRING_INLINE;
+    }
+    else
+    {
+        *(char **)str = chars;
+        *(int *)(str + PTR_SIZE) = len;
+    }
+}
\ No newline at end of file
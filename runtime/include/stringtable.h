@@ -0,0 +1,39 @@
+#pragma once
+#include "function.h"
+#include <memory>
+
+// where a constant's chars are in the table
+struct StringConstant
+{
+    char *ptr;
+    int len;
+};
+
+// String constants are interned once at load time into one immutable
+// block, with each distinct string stored once. LOAD_STRING pushes a
+// view into the block, so a string literal never allocates, and
+// anything that changes a string must copy it out of the block first
+class StringTable
+{
+    std::unique_ptr<char[]> block;
+    size_t size = 0;
+    // each function's constants, indexed by LOAD_STRING's oprand
+    std::vector<std::vector<StringConstant>> constants;
+
+public:
+    StringTable() = default;
+    StringTable(const std::vector<Function> &functions);
+
+    const StringConstant &Get(size_t func, oprand_t index) const
+    {
+        return constants[func][index];
+    };
+
+    const char *Begin() const { return block.get(); };
+    size_t Size() const { return size; };
+
+    bool Contains(const char *str) const
+    {
+        return str >= block.get() && str < block.get() + size;
+    };
+};
\ No newline at end of file
@@ -0,0 +1,60 @@
+#pragma once
+#include "op.h"
+#include <atomic>
+#include <memory>
+#include <string>
+
+// entries kept, the most recent ones, a power of 2
+#define TRACE_DEF_CAPACITY (1U << 16)
+
+// starts a trace file, followed by the entries oldest first
+struct TraceHeader
+{
+    uint32_t magic;
+    // set when the trace is of the register code
+    uint32_t register_code;
+    // ops executed in all, of which the last num_entries were kept
+    uint64_t total;
+    uint64_t num_entries;
+};
+
+constexpr uint32_t TRACE_MAGIC = 0x43525454;
+
+struct TraceEntry
+{
+    oprand_t function;
+    oprand_t ip;
+    // in bytes, before the op ran
+    oprand_t stack_size;
+    Opcode code;
+};
+
+// Keeps the last ops the interpreter executed in a ring buffer. Only
+// the interpreter writes to it, and the count of entries is advanced
+// after each entry is written, so the buffer can be dumped from a
+// signal handler while the program runs, at worst with the oldest
+// entry overwritten part way. Dumping only uses write(2) for that
+// reason
+class Tracer
+{
+    std::unique_ptr<TraceEntry[]> entries;
+    size_t mask;
+    uint64_t total = 0;
+
+public:
+    // where the trace is dumped to
+    std::string path;
+    bool register_code = false;
+
+    Tracer(size_t capacity = TRACE_DEF_CAPACITY) : entries(new TraceEntry[capacity]), mask(capacity - 1){};
+
+    void Record(oprand_t function, oprand_t ip, oprand_t stack_size, Opcode code)
+    {
+        entries[total & mask] = {function, ip, stack_size, code};
+        std::atomic_signal_fence(std::memory_order_release);
+        total++;
+    };
+
+    // returns false if the trace could not be written
+    bool Dump() const;
+};
\ No newline at end of file
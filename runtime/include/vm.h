@@ -1,68 +1,241 @@
 #pragma once
 #include "callstack.h"
-#include "function.h"
-#include "libfuncdef.h"
+#include "arrayslot.h"
+#include "globals.h"
+#include "heap.h"
+#include "jit.h"
 #include "nativefuncimpl.h"
+#include "output.h"
 #include "perror.h"
+#include "program.h"
 #include "serialise.h"
 #include "stack.h"
-#include "throwinfo.h"
+#include "tracer.h"
 #include <dlfcn.h>
 #include <fstream>
 #include <iostream>
-#include <stack>
-#include <unordered_map>
-#include <unordered_set>
-
-typedef ReturnValue (*LibFunc)(char *);
+#include <memory>
 
 class VM
 {
     // private:
 public:
-    std::vector<Function> functions;
-    std::unordered_map<oprand_t, std::unordered_set<oprand_t>> struct_tree;
-
-    const std::vector<LibFunc> natives{PrintInt, PrintDouble, PrintBool, PrintString, PrintChar};
+    // shared with every other VM running the same program
+    std::shared_ptr<Program> program;
 
-    std::vector<std::pair<LibFunc, size_t>>
-        CLibs;
-    std::vector<void *> lib_handles;
-
-    std::vector<ThrowInfo> throw_infos;
-    std::stack<ThrowInfo> throw_stack;
+    static inline const std::vector<NativeFunction> natives{
+#define x(impl, signature) {NativeTrampoline<impl>::Call, NativeTrampoline<impl>::arg_size, NativeTrampoline<impl>::ret_size},
+        NATIVES(x)
+#undef x
+    };
 
     // instruction pointer
     size_t ip;
 
     // Call stack
-    std::vector<CallFrame> cs;
-    CallFrame *cur_cf;
+    CallStack cs{STACK_MAX};
+    CallFrame *cur_cf = nullptr;
 
     // current function index
     size_t cur_func;
-    size_t cur_routine;
     Stack stack;
+    Globals globals;
+
+    // what the program allocates, collected with the stack and
+    // the globals as roots
+    Heap heap;
+    // where PRINT writes to
+    Output *out = &StdOut();
+
+    // set when hot functions are compiled to machine code
+    std::unique_ptr<JIT> jit;
+
+#ifdef VM_PROFILE_OPCODES
+    // number of times each pair and triple of opcodes were executed
+    // one after the other, triples keyed by their packed opcodes
+    std::vector<size_t> op_pairs = std::vector<size_t>(NUM_OPCODES * NUM_OPCODES);
+    std::unordered_map<size_t, size_t> op_triples;
+    Opcode prev_ops[2]{Opcode::NONE, Opcode::NONE};
+
+    void RecordOpcode(Opcode o)
+    {
+        size_t a = static_cast<size_t>(prev_ops[0]);
+        size_t b = static_cast<size_t>(prev_ops[1]);
+        size_t c = static_cast<size_t>(o);
+
+        op_pairs[b * NUM_OPCODES + c]++;
+        op_triples[(a * NUM_OPCODES + b) * NUM_OPCODES + c]++;
 
-    void Jump(size_t jump);
-    void ExecuteInstruction();
+        prev_ops[0] = prev_ops[1];
+        prev_ops[1] = o;
+    }
+#endif
+
+#ifdef VM_TRACE
+    Tracer tracer;
+#endif
 
 public:
-    VM() = default;
+    VM(std::shared_ptr<Program> _program);
     VM(std::vector<Function> &functions,
        oprand_t main_index,
        std::unordered_map<oprand_t, std::unordered_set<oprand_t>> &struct_tree,
-       std::vector<LibraryFunctionDef> &,
-       std::vector<ThrowInfo> &);
+       std::vector<LibraryFunctionDef> &lib_funcs,
+       std::vector<ThrowInfo> &throw_infos,
+       const std::vector<char> &global_data = {},
+       const GlobalRefs &global_refs = {})
+        : VM(std::make_shared<Program>(functions, main_index, struct_tree, lib_funcs, throw_infos, global_data, global_refs)){};
 
     void Disasemble();
     void PrintCallStack();
     void ExecuteProgram();
+    // runs the global initialisers in function 0, stopping short of
+    // its call to Main, which ExecuteProgram then starts from. Only
+    // for a VM that has not run anything yet
+    void Initialise();
+
+    // runs the initialisers and writes the globals and heap they leave
+    // behind to path, for Restore to load in place of running them
+    void Snapshot(const std::string &path);
+    // loads a snapshot taken by Snapshot into a VM that has not run
+    // anything yet, false if there is none at path or it was taken
+    // of a different program
+    bool Restore(const std::string &path);
 
     void RuntimeError(const std::string &msg);
-    static VM DeserialiseProgram(const std::string &fPath);
+    // for errors where there is no VM to report them from
+    static void Abort(const std::string &msg);
+    // unwinds to the catch clause for the value on top, thrown by a
+    // THROW with the oprand, and leaves the value in its variable
+    void Throw(oprand_t thrown);
+    static std::shared_ptr<Program> LoadProgram(const std::string &fPath);
+    static VM DeserialiseProgram(const std::string &fPath) { return VM(LoadProgram(fPath)); };
+
+    // UseRegisterCode and LoadAOT change the program, so they must be
+    // called before any other VM shares it
+
+    // switches execution over to three-address register instructions
+    // translated from each function's stack code
+    void UseRegisterCode();
+    void EnableJIT();
+    // the deepest the calls can nest, STACK_MAX by default
+    void SetMaxCallDepth(size_t depth);
+    // the bytes allocated before the first collection, and how many
+    // times what survives a collection the heap may grow to
+    void SetGCThreshold(size_t bytes);
+    void SetGCGrowth(double factor);
+    // "line", "size" or "exit"
+    void SetFlushPolicy(const std::string &policy);
+
+    // writes the program out as a C++ translation unit, and loads
+    // the module built from it to run in place of the interpreter
+    void EmitCpp(const std::string &path);
+    void LoadAOT(const std::string &path);
+
+    // adds this run's opcode pair and triple counts to the profile
+    // at path, so that it accumulates over a corpus of programs
+    void DumpOpcodeProfile(const std::string &path);
+    // with a runtime built with VM_TRACE, keeps the last ops executed
+    // to dump to path at exit, on a runtime error or on SIGUSR1
+    void TraceTo(const std::string &path);
+    void DumpTrace();
+    // prints a trace of this program as a timeline of its ops
+    void PrintTrace(const std::string &path);
+    // ranks the sequences in a profile by the dispatches a
+    // superinstruction for each would save
+    static void SuggestSuperinstructions(const std::string &path, size_t n);
+
+private:
+    friend struct Program;
+
+    // the interpreter, running from ip in the frame on top
+    void Run();
+
+    // the program, once it is certain no other VM is running it
+    Program &ProgramToChange();
+
+    void Collect()
+    {
+        heap.Collect({{stack.GetBottom(), stack.GetTop()}, {globals.GetBegin(), globals.GetEnd()}});
+    }
+
+    void CollectIfDue(size_t bytes)
+    {
+        if (heap.ShouldCollect(bytes))
+            Collect();
+    }
+
+    // these collect first if the heap is due, so anything the new
+    // object is built from must be on the stack
+
+    // a string buffer with room for capacity chars
+    char *NewString(int capacity);
+    // an array with its elements zeroed
+    char *NewArray(int length, oprand_t element_size, bool holds_refs);
+
+    // an index outside [0, length) is a runtime error
+    void CheckIndex(int index, int length)
+    {
+        if (static_cast<unsigned>(index) >= static_cast<unsigned>(length))
+            RuntimeError("Index " + std::to_string(index) + " is out of range for length " + std::to_string(length));
+    }
+
+    void CheckArrayIndex(char *arr, int index)
+    {
+        if (arr == nullptr)
+            RuntimeError("Indexing an array that was never allocated");
+        CheckIndex(index, ArrayLength(arr));
+    }
+
+    // lays a function's routines out as one contiguous code array,
+    // rewriting routine-relative branches into absolute offsets,
+    // and returns the offset each routine was given
+    static std::vector<oprand_t> LinkFunction(Function &f);
+    static bool EndsRoutine(const std::vector<Op> &routine);
+    // rewrites the heads of common sequences into superinstructions
+    static void FuseSuperinstructions(Function &f);
+    // returns each stack op's offset in the register code
+    static std::vector<oprand_t> TranslateToRegisterCode(Function &f);
+
+    // reads and writes of register instruction oprands
+    int RegInt(const oprand_t r)
+    {
+        // stack slots are the common case and need just the one test
+        if (r & REG_CONST)
+            return r == REG_STACK ? stack.PopInt() : cur_cf->ints[r & ~REG_CONST];
+        return stack.GetInt(r);
+    }
+
+    void RegSetInt(const oprand_t r, const int x)
+    {
+        if (r == REG_STACK)
+            stack.PushInt(x);
+        else
+            stack.SetInt(r, x);
+    }
+
+    double RegDouble(const oprand_t r)
+    {
+        // stack slots are the common case and need just the one test
+        if (r & REG_CONST)
+            return r == REG_STACK ? stack.PopDouble() : cur_cf->doubles[r & ~REG_CONST];
+        return stack.GetDouble(r);
+    }
+
+    void RegSetDouble(const oprand_t r, const double x)
+    {
+        if (r == REG_STACK)
+            stack.PushDouble(x);
+        else
+            stack.SetDouble(r, x);
+    }
+
+public:
+    // the opcode a superinstruction was fused over
+    static Opcode UnfusedOpcode(Opcode code);
 
 private:
+
     static bool DoesFileExist(const std::string &path);
     static void DeserialisationError(const std::string &err);
     static Function DeserialiseFunction(std::ifstream &file);
@@ -72,6 +245,7 @@ private:
     static std::vector<double> DeserialiseDoubles(std::ifstream &file);
     static std::vector<bool> DeserialiseBools(std::ifstream &file);
     static std::vector<char> DeserialiseChars(std::ifstream &file);
+    static std::vector<oprand_t> DeserialiseOprands(std::ifstream &file);
     static std::vector<std::string> DeserialiseStrings(std::ifstream &file);
     static std::vector<std::vector<Op>> DeserialiseOps(std::ifstream &file);
     static std::vector<ThrowInfo> DeserialiseThrowInfos(std::ifstream &file);
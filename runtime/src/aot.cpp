@@ -0,0 +1,947 @@
+#include "aot.h"
+#include "vm.h"
+#include <cmath>
+#include <set>
+#include <sstream>
+
+// The C++ backend. Each function's stack code is run symbolically to
+// find what is on the stack before every instruction, and every value
+// in the frame becomes a typed C++ local named after its type and
+// offset, so that 'GET_INT 4; LOAD_INT 0; I_ADD' comes out as
+//      i8 = i4;
+//      i12 = 1;
+//      i8 = i8 + i12;
+// which the C++ compiler turns back into registers. Calls between
+// translated functions are direct. A function that uses anything the
+// translation does not understand, or calls one that does, is left to
+// the interpreter
+enum class Kind : uint8_t
+{
+    INT,
+    DOUBLE,
+    BOOL,
+    CHAR,
+    OPRAND,
+    // the arguments until they are read, and values whose
+    // type is not known yet
+    UNKNOWN,
+};
+
+struct Value
+{
+    Kind kind;
+    oprand_t offset;
+    oprand_t size;
+    // the oprand of a PUSH
+    oprand_t constant;
+};
+
+// what is on the stack before an instruction
+struct FrameState
+{
+    std::vector<Value> values;
+    oprand_t top = 0;
+};
+
+struct AotSignature
+{
+    oprand_t ret_size = 0;
+    Kind ret_kind = Kind::UNKNOWN;
+    bool translated = true;
+
+    bool IsKnown() const { return ret_size == 0 || ret_kind != Kind::UNKNOWN; }
+};
+
+enum class Outcome
+{
+    DONE,
+    // waiting on the return type of a function it calls
+    PENDING,
+    FAILED,
+};
+
+static oprand_t KindSize(Kind k)
+{
+    switch (k)
+    {
+    case Kind::INT:
+        return INT_SIZE;
+    case Kind::DOUBLE:
+        return DOUBLE_SIZE;
+    case Kind::BOOL:
+        return BOOL_SIZE;
+    case Kind::CHAR:
+        return CHAR_SIZE;
+    default:
+        return OPRAND_SIZE;
+    }
+}
+
+static const char *CType(Kind k)
+{
+    switch (k)
+    {
+    case Kind::INT:
+        return "int";
+    case Kind::DOUBLE:
+        return "double";
+    case Kind::BOOL:
+        return "bool";
+    case Kind::CHAR:
+        return "char";
+    default:
+        return "uint32_t";
+    }
+}
+
+static std::string Var(Kind k, oprand_t offset)
+{
+    const char prefixes[] = {'i', 'd', 'b', 'c', 'o', 'u'};
+    return prefixes[static_cast<size_t>(k)] + std::to_string(offset);
+}
+
+static std::string Var(const Value &v) { return Var(v.kind, v.offset); }
+
+static std::string DoubleLiteral(double x)
+{
+    if (std::isnan(x))
+        return "__builtin_nan(\"\")";
+    if (std::isinf(x))
+        return x > 0 ? "__builtin_inf()" : "-__builtin_inf()";
+
+    // exact, unlike the decimal form
+    std::ostringstream s;
+    s << std::hexfloat << x;
+    return s.str();
+}
+
+struct BinaryForm
+{
+    Opcode code;
+    Kind left;
+    Kind right;
+    Kind result;
+    const char *op;
+};
+
+static const std::vector<BinaryForm> binary_forms{
+    {Opcode::I_ADD, Kind::INT, Kind::INT, Kind::INT, "+"},
+    {Opcode::DI_ADD, Kind::DOUBLE, Kind::INT, Kind::DOUBLE, "+"},
+    {Opcode::ID_ADD, Kind::INT, Kind::DOUBLE, Kind::DOUBLE, "+"},
+    {Opcode::D_ADD, Kind::DOUBLE, Kind::DOUBLE, Kind::DOUBLE, "+"},
+    {Opcode::I_SUB, Kind::INT, Kind::INT, Kind::INT, "-"},
+    {Opcode::DI_SUB, Kind::DOUBLE, Kind::INT, Kind::DOUBLE, "-"},
+    {Opcode::ID_SUB, Kind::INT, Kind::DOUBLE, Kind::DOUBLE, "-"},
+    {Opcode::D_SUB, Kind::DOUBLE, Kind::DOUBLE, Kind::DOUBLE, "-"},
+    {Opcode::I_MUL, Kind::INT, Kind::INT, Kind::INT, "*"},
+    {Opcode::DI_MUL, Kind::DOUBLE, Kind::INT, Kind::DOUBLE, "*"},
+    {Opcode::ID_MUL, Kind::INT, Kind::DOUBLE, Kind::DOUBLE, "*"},
+    {Opcode::D_MUL, Kind::DOUBLE, Kind::DOUBLE, Kind::DOUBLE, "*"},
+    {Opcode::I_DIV, Kind::INT, Kind::INT, Kind::INT, "/"},
+    {Opcode::DI_DIV, Kind::DOUBLE, Kind::INT, Kind::DOUBLE, "/"},
+    {Opcode::ID_DIV, Kind::INT, Kind::DOUBLE, Kind::DOUBLE, "/"},
+    {Opcode::D_DIV, Kind::DOUBLE, Kind::DOUBLE, Kind::DOUBLE, "/"},
+    {Opcode::I_GT, Kind::INT, Kind::INT, Kind::BOOL, ">"},
+    {Opcode::DI_GT, Kind::DOUBLE, Kind::INT, Kind::BOOL, ">"},
+    {Opcode::ID_GT, Kind::INT, Kind::DOUBLE, Kind::BOOL, ">"},
+    {Opcode::D_GT, Kind::DOUBLE, Kind::DOUBLE, Kind::BOOL, ">"},
+    {Opcode::I_LT, Kind::INT, Kind::INT, Kind::BOOL, "<"},
+    {Opcode::DI_LT, Kind::DOUBLE, Kind::INT, Kind::BOOL, "<"},
+    {Opcode::ID_LT, Kind::INT, Kind::DOUBLE, Kind::BOOL, "<"},
+    {Opcode::D_LT, Kind::DOUBLE, Kind::DOUBLE, Kind::BOOL, "<"},
+    {Opcode::I_GEQ, Kind::INT, Kind::INT, Kind::BOOL, ">="},
+    {Opcode::DI_GEQ, Kind::DOUBLE, Kind::INT, Kind::BOOL, ">="},
+    {Opcode::ID_GEQ, Kind::INT, Kind::DOUBLE, Kind::BOOL, ">="},
+    {Opcode::D_GEQ, Kind::DOUBLE, Kind::DOUBLE, Kind::BOOL, ">="},
+    {Opcode::I_LEQ, Kind::INT, Kind::INT, Kind::BOOL, "<="},
+    {Opcode::DI_LEQ, Kind::DOUBLE, Kind::INT, Kind::BOOL, "<="},
+    {Opcode::ID_LEQ, Kind::INT, Kind::DOUBLE, Kind::BOOL, "<="},
+    {Opcode::D_LEQ, Kind::DOUBLE, Kind::DOUBLE, Kind::BOOL, "<="},
+    {Opcode::I_EQ_EQ, Kind::INT, Kind::INT, Kind::BOOL, "=="},
+    {Opcode::DI_EQ_EQ, Kind::DOUBLE, Kind::INT, Kind::BOOL, "=="},
+    {Opcode::ID_EQ_EQ, Kind::INT, Kind::DOUBLE, Kind::BOOL, "=="},
+    {Opcode::D_EQ_EQ, Kind::DOUBLE, Kind::DOUBLE, Kind::BOOL, "=="},
+    {Opcode::B_EQ_EQ, Kind::BOOL, Kind::BOOL, Kind::BOOL, "=="},
+    {Opcode::I_BANG_EQ, Kind::INT, Kind::INT, Kind::BOOL, "!="},
+    {Opcode::DI_BANG_EQ, Kind::DOUBLE, Kind::INT, Kind::BOOL, "!="},
+    {Opcode::ID_BANG_EQ, Kind::INT, Kind::DOUBLE, Kind::BOOL, "!="},
+    {Opcode::D_BANG_EQ, Kind::DOUBLE, Kind::DOUBLE, Kind::BOOL, "!="},
+    {Opcode::B_BANG_EQ, Kind::BOOL, Kind::BOOL, Kind::BOOL, "!="},
+    {Opcode::B_AND_AND, Kind::BOOL, Kind::BOOL, Kind::BOOL, "&&"},
+    {Opcode::B_OR_OR, Kind::BOOL, Kind::BOOL, Kind::BOOL, "||"},
+};
+
+// the kind a variable read or assignment moves
+static bool VariableKind(Opcode code, Kind &k)
+{
+    switch (code)
+    {
+    case Opcode::GET_INT:
+    case Opcode::INT_ASSIGN:
+        k = Kind::INT;
+        return true;
+    case Opcode::GET_DOUBLE:
+    case Opcode::DOUBLE_ASSIGN:
+        k = Kind::DOUBLE;
+        return true;
+    case Opcode::GET_BOOL:
+    case Opcode::BOOL_ASSIGN:
+        k = Kind::BOOL;
+        return true;
+    case Opcode::GET_CHAR:
+    case Opcode::CHAR_ASSIGN:
+        k = Kind::CHAR;
+        return true;
+    default:
+        return false;
+    }
+}
+
+class FunctionTranslator
+{
+public:
+    FunctionTranslator(const std::vector<Function> &_functions, std::vector<AotSignature> &_sigs, size_t _index)
+        : functions(_functions), sigs(_sigs), index(_index), f(_functions[_index])
+    {
+    }
+
+    // works out the stack before every reachable instruction, and
+    // the function's return type if it was not known
+    Outcome Analyse()
+    {
+        size_t n = f.code.size();
+        states.assign(n, FrameState());
+        reached.assign(n, false);
+
+        FrameState entry;
+        entry.top = f.arg_size;
+        if (f.arg_size > 0)
+            entry.values.push_back({Kind::UNKNOWN, 0, f.arg_size, 0});
+
+        std::vector<size_t> worklist{0};
+        states[0] = entry;
+        reached[0] = true;
+
+        while (!worklist.empty())
+        {
+            size_t ip = worklist.back();
+            worklist.pop_back();
+
+            FrameState s = states[ip];
+            if (!Step(ip, s))
+                return Outcome::FAILED;
+
+            for (size_t next : Successors(ip))
+            {
+                if (next >= n)
+                    return Outcome::FAILED;
+                if (!reached[next])
+                {
+                    reached[next] = true;
+                    states[next] = s;
+                    worklist.push_back(next);
+                    continue;
+                }
+
+                bool changed;
+                if (!Merge(states[next], s, changed))
+                    return Outcome::FAILED;
+                if (changed)
+                    worklist.push_back(next);
+            }
+        }
+
+        // a recursive function can learn its return type from its
+        // base case while its recursive calls are still pending
+        AotSignature &sig = sigs[index];
+        if (ret_kind != Kind::UNKNOWN && sig.ret_kind == Kind::UNKNOWN && sig.ret_size != 0)
+            sig.ret_kind = ret_kind;
+        return pending ? Outcome::PENDING : Outcome::DONE;
+    }
+
+    void Emit(std::ostream &file)
+    {
+        std::vector<bool> is_target(f.code.size(), false);
+        for (size_t ip = 0; ip < f.code.size(); ip++)
+        {
+            if (reached[ip] && IsJump(ip))
+                is_target[f.code[ip].op] = true;
+        }
+
+        std::ostringstream body;
+        out = &body;
+        for (size_t ip = 0; ip < f.code.size(); ip++)
+        {
+            if (!reached[ip])
+                continue;
+            if (is_target[ip])
+                body << "L" << ip << ":;\n";
+
+            FrameState s = states[ip];
+            Step(ip, s);
+        }
+        out = nullptr;
+
+        file << "static void f" << index << "(char *args)\n{\n";
+        for (const auto &local : locals)
+            file << "    " << CType(local.first) << " " << Var(local.first, local.second) << " = 0;\n";
+        if (makes_calls)
+            file << "    if (++depth > host->max_call_depth)\n"
+                 << "        host->call_stack_overflow();\n";
+        if (tail_calls_self)
+            file << "entry:\n";
+        for (const auto &arg : arg_reads)
+        {
+            std::string var = Var(arg.first, arg.second);
+            file << "    std::memcpy(&" << var << ", args + " << arg.second << ", sizeof(" << var << "));\n";
+        }
+        file << body.str() << "}\n\n";
+    }
+
+private:
+    const std::vector<Function> &functions;
+    std::vector<AotSignature> &sigs;
+    size_t index;
+    const Function &f;
+
+    std::vector<FrameState> states;
+    std::vector<bool> reached;
+
+    // every (kind, offset) pair the function's values take up
+    std::set<std::pair<Kind, oprand_t>> locals;
+    // the arguments, read from the caller at entry
+    std::set<std::pair<Kind, oprand_t>> arg_reads;
+    bool makes_calls = false;
+    bool tail_calls_self = false;
+    bool pending = false;
+    Kind ret_kind = Kind::UNKNOWN;
+
+    // set while emitting
+    std::ostringstream *out = nullptr;
+
+    void Line(const std::string &line)
+    {
+        if (out != nullptr)
+            *out << "    " << line << "\n";
+    }
+
+    bool IsJump(size_t ip)
+    {
+        Opcode code = VM::UnfusedOpcode(f.code[ip].code);
+        return code == Opcode::GOTO_LABEL || code == Opcode::GOTO_LABEL_IF_FALSE || code == Opcode::SET_IP;
+    }
+
+    std::vector<size_t> Successors(size_t ip)
+    {
+        const Op &o = f.code[ip];
+        switch (VM::UnfusedOpcode(o.code))
+        {
+        case Opcode::GOTO_LABEL:
+        case Opcode::SET_IP:
+            return {o.op};
+        case Opcode::GOTO_LABEL_IF_FALSE:
+            return {ip + 1, o.op};
+        case Opcode::TAIL_CALL:
+        case Opcode::RETURN:
+        case Opcode::RETURN_VOID:
+            return {};
+        default:
+            return {ip + 1};
+        }
+    }
+
+    // joins the stack from another path into a branch target, which
+    // must have the same values on it
+    bool Merge(FrameState &into, const FrameState &from, bool &changed)
+    {
+        changed = false;
+        if (into.top != from.top || into.values.size() != from.values.size())
+            return false;
+
+        for (size_t i = 0; i < into.values.size(); i++)
+        {
+            Value &a = into.values[i];
+            const Value &b = from.values[i];
+            if (a.offset != b.offset || a.size != b.size || a.constant != b.constant)
+                return false;
+            if (a.kind != b.kind && a.kind != Kind::UNKNOWN)
+            {
+                a.kind = Kind::UNKNOWN;
+                changed = true;
+            }
+        }
+        return true;
+    }
+
+    Value Push(FrameState &s, Kind k)
+    {
+        Value v{k, s.top, KindSize(k), 0};
+        s.values.push_back(v);
+        s.top += v.size;
+        locals.insert({k, v.offset});
+        return v;
+    }
+
+    // a value whose type is not known yet is taken to be k, and the
+    // function is tried again once it is
+    bool Pop(FrameState &s, Kind k, Value &v)
+    {
+        if (s.values.empty() || s.values.back().offset < f.arg_size)
+            return false;
+
+        v = s.values.back();
+        if (v.size != KindSize(k))
+            return false;
+        if (v.kind != k)
+        {
+            if (v.kind != Kind::UNKNOWN)
+                return false;
+            pending = true;
+            v.kind = k;
+        }
+
+        s.values.pop_back();
+        s.top = v.offset;
+        return true;
+    }
+
+    // the values making up the top n bytes, bottom first
+    bool PopBytes(FrameState &s, oprand_t n, std::vector<Value> &popped)
+    {
+        oprand_t bottom = s.top - n;
+        if (n > s.top - f.arg_size)
+            return false;
+
+        while (s.top > bottom)
+        {
+            popped.insert(popped.begin(), s.values.back());
+            s.values.pop_back();
+            s.top = popped.front().offset;
+        }
+        return s.top == bottom;
+    }
+
+    // copies values out to a buffer laid out as they were on the
+    // stack. PUSH oprands are only known as constants, and only the
+    // ops left to the interpreter read them
+    bool Materialise(const std::vector<Value> &values, const std::string &buf, const std::string &indent)
+    {
+        for (const Value &v : values)
+        {
+            if (v.kind == Kind::OPRAND)
+                return false;
+            if (v.kind == Kind::UNKNOWN)
+            {
+                pending = true;
+                continue;
+            }
+            std::string var = Var(v);
+            Line(indent + "std::memcpy(" + buf + " + " + std::to_string(v.offset - values.front().offset) + ", &" + var + ", sizeof(" + var + "));");
+        }
+        return true;
+    }
+
+    // a local variable, read or written by GET and ASSIGN ops
+    bool Variable(FrameState &s, Kind k, oprand_t offset, bool is_write)
+    {
+        locals.insert({k, offset});
+        if (offset < f.arg_size)
+        {
+            arg_reads.insert({k, offset});
+            return true;
+        }
+
+        for (Value &v : s.values)
+        {
+            if (v.offset != offset)
+                continue;
+            if (v.kind == k)
+                return true;
+            if (v.kind != Kind::UNKNOWN || v.size != KindSize(k))
+                return false;
+
+            if (is_write)
+                v.kind = k;
+            else
+                pending = true;
+            return true;
+        }
+        return false;
+    }
+
+    void FoundReturnKind(Kind k)
+    {
+        if (ret_kind == Kind::UNKNOWN)
+            ret_kind = k;
+        else if (ret_kind != k)
+            pending = true;
+    }
+
+    void Leave()
+    {
+        if (makes_calls)
+            Line("depth--;");
+        Line("return;");
+    }
+
+    bool Call(FrameState &s, oprand_t callee, bool is_tail)
+    {
+        if (callee >= functions.size() || !sigs[callee].translated)
+            return false;
+
+        const AotSignature &sig = sigs[callee];
+        std::vector<Value> args;
+        if (!PopBytes(s, functions[callee].arg_size, args))
+            return false;
+
+        if (is_tail && callee == index)
+        {
+            tail_calls_self = true;
+            if (!Materialise(args, "args", ""))
+                return false;
+            Line("goto entry;");
+            return true;
+        }
+
+        makes_calls = true;
+        if (is_tail && sig.ret_size != sigs[index].ret_size)
+            return false;
+
+        oprand_t buf_size = std::max<oprand_t>(std::max(functions[callee].arg_size, sig.ret_size), 1);
+        Line("{");
+        Line("    char a[" + std::to_string(buf_size) + "];");
+        if (!Materialise(args, "a", "    "))
+            return false;
+        Line("    f" + std::to_string(callee) + "(a);");
+
+        if (is_tail)
+        {
+            if (sig.ret_size != 0)
+            {
+                if (sig.IsKnown())
+                    FoundReturnKind(sig.ret_kind);
+                Line("    std::memcpy(args, a, " + std::to_string(sig.ret_size) + ");");
+            }
+            Line("}");
+            Leave();
+            return true;
+        }
+
+        if (sig.ret_size != 0)
+        {
+            if (sig.IsKnown())
+            {
+                std::string var = Var(Push(s, sig.ret_kind));
+                Line("    std::memcpy(&" + var + ", a, sizeof(" + var + "));");
+            }
+            else
+            {
+                s.values.push_back({Kind::UNKNOWN, s.top, sig.ret_size, 0});
+                s.top += sig.ret_size;
+            }
+        }
+        Line("}");
+        return true;
+    }
+
+    bool Return(FrameState &s, oprand_t size)
+    {
+        std::vector<Value> ret;
+        if (size != sigs[index].ret_size || !PopBytes(s, size, ret) || ret.size() != 1)
+            return false;
+
+        if (ret[0].kind == Kind::UNKNOWN)
+            pending = true;
+        else
+            FoundReturnKind(ret[0].kind);
+
+        if (!Materialise(ret, "args", ""))
+            return false;
+        Leave();
+        return true;
+    }
+
+    static bool PrintNative(oprand_t type, oprand_t &native)
+    {
+        void (*print)(char *);
+        switch (type)
+        {
+        case INT_TYPE.type:
+            print = NativeTrampoline<PrintInt>::Call;
+            break;
+        case DOUBLE_TYPE.type:
+            print = NativeTrampoline<PrintDouble>::Call;
+            break;
+        case BOOL_TYPE.type:
+            print = NativeTrampoline<PrintBool>::Call;
+            break;
+        case STRING_TYPE.type:
+            print = NativeTrampoline<PrintString>::Call;
+            break;
+        case CHAR_TYPE.type:
+            print = NativeTrampoline<PrintChar>::Call;
+            break;
+        default:
+            return false;
+        }
+
+        for (native = 0; native < VM::natives.size(); native++)
+        {
+            if (VM::natives[native].call == print)
+                return true;
+        }
+        return false;
+    }
+
+    bool NativeCall(FrameState &s, oprand_t native)
+    {
+        // the kind of value a native returns is not known here,
+        // so calls to those are left to the interpreter
+        const NativeFunction &nf = VM::natives[native];
+        std::vector<Value> args;
+        if (nf.ret_size != 0 || !PopBytes(s, nf.arg_size, args))
+            return false;
+
+        Line("{");
+        Line("    char a[" + std::to_string(std::max<oprand_t>(nf.arg_size, 1)) + "];");
+        if (!Materialise(args, "a", "    "))
+            return false;
+        Line("    host->native_call(" + std::to_string(native) + ", a);");
+        Line("}");
+        return true;
+    }
+
+    bool Step(size_t ip, FrameState &s)
+    {
+        const Op &o = f.code[ip];
+        Opcode code = VM::UnfusedOpcode(o.code);
+        Kind k;
+
+        switch (code)
+        {
+        case Opcode::POP:
+        {
+            std::vector<Value> popped;
+            return PopBytes(s, o.op, popped);
+        }
+        case Opcode::LOAD_INT:
+            Line(Var(Push(s, Kind::INT)) + " = " + std::to_string(f.ints[o.op]) + ";");
+            return true;
+        case Opcode::LOAD_DOUBLE:
+            Line(Var(Push(s, Kind::DOUBLE)) + " = " + DoubleLiteral(f.doubles[o.op]) + ";");
+            return true;
+        case Opcode::LOAD_BOOL:
+            Line(Var(Push(s, Kind::BOOL)) + " = " + (f.bools[o.op] ? "true" : "false") + ";");
+            return true;
+        case Opcode::LOAD_CHAR:
+            Line(Var(Push(s, Kind::CHAR)) + " = (char)" + std::to_string(+f.chars[o.op]) + ";");
+            return true;
+        case Opcode::GET_INT:
+        case Opcode::GET_DOUBLE:
+        case Opcode::GET_BOOL:
+        case Opcode::GET_CHAR:
+        {
+            VariableKind(code, k);
+            if (!Variable(s, k, o.op, false))
+                return false;
+            Line(Var(Push(s, k)) + " = " + Var(k, o.op) + ";");
+            return true;
+        }
+        case Opcode::INT_ASSIGN:
+        case Opcode::DOUBLE_ASSIGN:
+        case Opcode::BOOL_ASSIGN:
+        case Opcode::CHAR_ASSIGN:
+        {
+            // the assigned value stays on the stack
+            VariableKind(code, k);
+            Value v;
+            if (!Pop(s, k, v) || !Variable(s, k, o.op, true))
+                return false;
+            s.values.push_back(v);
+            s.top += v.size;
+            Line(Var(k, o.op) + " = " + Var(v) + ";");
+            return true;
+        }
+        case Opcode::PUSH:
+            s.values.push_back({Kind::OPRAND, s.top, OPRAND_SIZE, o.op});
+            s.top += OPRAND_SIZE;
+            return true;
+        case Opcode::GOTO_LABEL:
+        case Opcode::SET_IP:
+            Line("goto L" + std::to_string(o.op) + ";");
+            return true;
+        case Opcode::GOTO_LABEL_IF_FALSE:
+        {
+            Value v;
+            if (!Pop(s, Kind::BOOL, v))
+                return false;
+            Line("if (!" + Var(v) + ")");
+            Line("    goto L" + std::to_string(o.op) + ";");
+            return true;
+        }
+        case Opcode::CALL_F:
+            return Call(s, o.op, false);
+        case Opcode::TAIL_CALL:
+            return Call(s, o.op, true);
+        case Opcode::RETURN:
+            return Return(s, o.op);
+        case Opcode::RETURN_VOID:
+            if (sigs[index].ret_size != 0)
+                return false;
+            Leave();
+            return true;
+        case Opcode::NATIVE_CALL:
+            return NativeCall(s, o.op);
+        case Opcode::PRINT:
+        {
+            // goes through the Print native for the type, which
+            // writes to the same output
+            oprand_t native;
+            return PrintNative(o.op, native) && NativeCall(s, native);
+        }
+        case Opcode::BANG:
+        {
+            Value v;
+            if (!Pop(s, Kind::BOOL, v))
+                return false;
+            Line(Var(Push(s, Kind::BOOL)) + " = !" + Var(v) + ";");
+            return true;
+        }
+        default:
+            break;
+        }
+
+        // the stack code marks unary minus with a non-zero oprand
+        if ((code == Opcode::I_SUB || code == Opcode::D_SUB) && o.op != 0)
+        {
+            k = code == Opcode::I_SUB ? Kind::INT : Kind::DOUBLE;
+            Value v;
+            if (!Pop(s, k, v))
+                return false;
+            Line(Var(Push(s, k)) + " = -" + Var(v) + ";");
+            return true;
+        }
+
+        for (const auto &form : binary_forms)
+        {
+            if (form.code != code)
+                continue;
+
+            Value l, r;
+            if (!Pop(s, form.right, r) || !Pop(s, form.left, l))
+                return false;
+            Line(Var(Push(s, form.result)) + " = " + Var(l) + " " + form.op + " " + Var(r) + ";");
+            return true;
+        }
+
+        return false;
+    }
+};
+
+// bytes returned by function i, from its RETURNs or failing that
+// from the function it tail calls
+static oprand_t ReturnSize(const std::vector<Function> &functions, size_t i, std::vector<bool> &visited)
+{
+    if (visited[i])
+        return 0;
+    visited[i] = true;
+
+    for (const Op &o : functions[i].code)
+    {
+        if (o.code == Opcode::RETURN)
+            return o.op;
+    }
+    for (const Op &o : functions[i].code)
+    {
+        if (o.code == Opcode::TAIL_CALL && o.op < functions.size())
+            return ReturnSize(functions, o.op, visited);
+    }
+    return 0;
+}
+
+uint64_t ProgramFingerprint(const std::vector<Function> &functions, const std::vector<char> &global_data)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+    auto mix = [&h](uint64_t x)
+    {
+        for (size_t i = 0; i < 8; i++)
+        {
+            h ^= (x >> (8 * i)) & 0xFF;
+            h *= 0x100000001b3ULL;
+        }
+    };
+
+    for (const auto &f : functions)
+    {
+        mix(f.arg_size);
+        mix(f.code.size());
+        for (const Op &o : f.code)
+        {
+            mix(static_cast<uint64_t>(VM::UnfusedOpcode(o.code)));
+            mix(o.op);
+        }
+        for (int x : f.ints)
+            mix(static_cast<uint32_t>(x));
+        for (double x : f.doubles)
+        {
+            uint64_t bits;
+            std::memcpy(&bits, &x, sizeof(bits));
+            mix(bits);
+        }
+        for (bool x : f.bools)
+            mix(x);
+        for (char x : f.chars)
+            mix(static_cast<uint8_t>(x));
+        for (const std::string &str : f.strings)
+        {
+            mix(str.size());
+            for (char x : str)
+                mix(static_cast<uint8_t>(x));
+        }
+    }
+
+    mix(global_data.size());
+    for (char x : global_data)
+        mix(static_cast<uint8_t>(x));
+    return h;
+}
+
+void VM::EmitCpp(const std::string &path)
+{
+    size_t n = program->functions.size();
+    std::vector<AotSignature> sigs(n);
+    for (size_t i = 0; i < n; i++)
+    {
+        std::vector<bool> visited(n, false);
+        sigs[i].ret_size = ReturnSize(program->functions, i, visited);
+    }
+
+    // each pass can learn the return type of a function or find
+    // one that cannot be translated, which in turn can change what
+    // is known about its callers
+    while (true)
+    {
+        std::vector<Outcome> outcomes(n, Outcome::FAILED);
+        bool changed = false;
+        for (size_t i = 0; i < n; i++)
+        {
+            if (!sigs[i].translated)
+                continue;
+
+            bool was_known = sigs[i].IsKnown();
+            outcomes[i] = FunctionTranslator(program->functions, sigs, i).Analyse();
+            if (outcomes[i] == Outcome::FAILED)
+                sigs[i].translated = false;
+            changed |= outcomes[i] == Outcome::FAILED || (!was_known && sigs[i].IsKnown());
+        }
+        if (changed)
+            continue;
+
+        // nothing more will be learned about the ones still waiting
+        bool gave_up = false;
+        for (size_t i = 0; i < n; i++)
+        {
+            if (sigs[i].translated && outcomes[i] == Outcome::PENDING)
+            {
+                sigs[i].translated = false;
+                gave_up = true;
+            }
+        }
+        if (!gave_up)
+            break;
+    }
+
+    std::ofstream file(path, std::ios::out | std::ios::trunc);
+    if (!file)
+        RuntimeError("Unable to write '" + path + "'");
+
+    file << "// translated from stack code by the runtime's -emit-cpp\n"
+         << "#include \"aot.h\"\n"
+         << "#include <cstring>\n\n"
+         << "static const AotHost *host;\n"
+         << "[[maybe_unused]] static thread_local size_t depth;\n\n";
+
+    for (size_t i = 0; i < n; i++)
+    {
+        if (sigs[i].translated)
+            file << "static void f" << i << "(char *args);\n";
+    }
+    file << "\n";
+
+    for (size_t i = 0; i < n; i++)
+    {
+        if (sigs[i].translated)
+        {
+            FunctionTranslator translator(program->functions, sigs, i);
+            translator.Analyse();
+            translator.Emit(file);
+        }
+    }
+
+    std::string table, ret_sizes;
+    size_t num_translated = 0;
+    for (size_t i = 0; i < n; i++)
+    {
+        table += sigs[i].translated ? "f" + std::to_string(i) : "nullptr";
+        ret_sizes += std::to_string(sigs[i].ret_size);
+        if (i + 1 < n)
+        {
+            table += ", ";
+            ret_sizes += ", ";
+        }
+        num_translated += sigs[i].translated;
+    }
+
+    file << "static const AotFunc functions[] = {" << table << "};\n"
+         << "static const uint32_t ret_sizes[] = {" << ret_sizes << "};\n"
+         << "static const AotModule module{" << n << ", " << program->fingerprint << "ULL, functions, ret_sizes};\n\n"
+         << "extern \"C\" const AotModule *aot_init(const AotHost *_host)\n"
+         << "{\n"
+         << "    host = _host;\n"
+         << "    return &module;\n"
+         << "}\n";
+
+    std::cout << "Translated " << num_translated << " of " << n << " functions to " << path << std::endl;
+}
+
+static void AotNativeCall(uint32_t index, char *args)
+{
+    VM::natives[index].call(args);
+}
+
+static void AotCallStackOverflow()
+{
+    std::cerr << "[RUNTIME ERROR] CallStack overflow in translated code" << std::endl;
+    exit(4);
+}
+
+static AotHost aot_host{AotNativeCall, STACK_MAX, AotCallStackOverflow};
+
+void VM::LoadAOT(const std::string &path)
+{
+    Program &p = ProgramToChange();
+    void *handle = dlopen(path.c_str(), RTLD_NOW);
+    if (handle == nullptr)
+        RuntimeError("Unable to load '" + path + "': " + dlerror());
+    p.lib_handles.push_back(handle);
+
+    AotInit init;
+    *(void **)&init = dlsym(handle, AOT_INIT_SYMBOL);
+    if (init == nullptr)
+        RuntimeError("'" + path + "' is not a translated program");
+
+    aot_host.max_call_depth = cs.Capacity();
+    p.aot_module = init(&aot_host);
+    if (p.aot_module->num_functions != p.functions.size() || p.aot_module->fingerprint != p.fingerprint)
+        RuntimeError("'" + path + "' was translated from a different program");
+
+    // calls to translated functions leave the interpreter
+    for (auto &f : p.functions)
+    {
+        for (Op &o : f.code)
+        {
+            if (o.code == Opcode::CALL_F && p.aot_module->functions[o.op] != nullptr)
+                o.code = Opcode::CALL_AOT;
+        }
+    }
+}
\ No newline at end of file
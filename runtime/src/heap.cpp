@@ -0,0 +1,132 @@
+#include "heap.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+ObjectHeader *Heap::Find(const char *addr)
+{
+    // the last object starting at or before addr
+    auto it = std::upper_bound(objects.begin(), objects.end(), addr,
+                               [](const char *a, const std::unique_ptr<char[]> &obj)
+                               { return a < obj.get(); });
+    if (it == objects.begin())
+        return nullptr;
+
+    ObjectHeader *h = (ObjectHeader *)(it - 1)->get();
+    return addr < (const char *)h + h->offset + h->size ? h : nullptr;
+}
+
+void Heap::MarkRange(const char *begin, const char *end, size_t stride, std::vector<ObjectHeader *> &grey)
+{
+    if (objects.empty())
+        return;
+    const ObjectHeader *last = (const ObjectHeader *)objects.back().get();
+    const char *lowest = objects.front().get();
+    const char *highest = (const char *)last + last->offset + last->size;
+
+    for (const char *p = begin; p + sizeof(char *) <= end; p += stride)
+    {
+        // values on the stack are not aligned
+        const char *addr;
+        std::memcpy(&addr, p, sizeof(char *));
+        if (addr < lowest || addr >= highest)
+            continue;
+
+        ObjectHeader *h = Find(addr);
+        if (h == nullptr || h->marked)
+            continue;
+
+        h->marked = true;
+        if (h->ref_stride != 0)
+            grey.push_back(h);
+    }
+}
+
+void Heap::Collect(std::initializer_list<RootRange> roots)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    std::sort(objects.begin(), objects.end(),
+              [](const std::unique_ptr<char[]> &a, const std::unique_ptr<char[]> &b)
+              { return a.get() < b.get(); });
+
+    std::vector<ObjectHeader *> grey;
+    for (const RootRange &r : roots)
+        MarkRange(r.begin, r.end, 1, grey);
+    while (!grey.empty())
+    {
+        ObjectHeader *h = grey.back();
+        grey.pop_back();
+        const char *payload = (const char *)h + h->offset;
+        MarkRange(payload, payload + h->size, h->ref_stride, grey);
+    }
+
+    size_t freed = 0;
+    auto live = std::remove_if(objects.begin(), objects.end(),
+                               [&freed](std::unique_ptr<char[]> &obj)
+                               {
+                                   ObjectHeader *h = (ObjectHeader *)obj.get();
+                                   if (h->marked)
+                                   {
+                                       h->marked = false;
+                                       return false;
+                                   }
+                                   freed += h->offset + h->size;
+                                   obj.reset();
+                                   return true;
+                               });
+    objects.erase(live, objects.end());
+
+    heap_bytes -= freed;
+    threshold = std::max(threshold, static_cast<size_t>(heap_bytes * growth));
+
+    double pause = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    stats.collections++;
+    stats.bytes_freed += freed;
+    stats.total_pause += pause;
+    stats.max_pause = std::max(stats.max_pause, pause);
+}
+
+char *Heap::Allocate(size_t size, uint32_t ref_stride, size_t prefix, size_t align)
+{
+    // new aligns to alignof(std::max_align_t), so the padding
+    // is only unknown up front for stricter alignments
+    size_t header = sizeof(ObjectHeader) + prefix;
+    size_t padding = align <= alignof(std::max_align_t) ? (align - header % align) % align : align - 1;
+    char *obj = new char[header + padding + size];
+
+    uintptr_t payload = reinterpret_cast<uintptr_t>(obj) + header;
+    payload = (payload + align - 1) / align * align;
+    uint32_t offset = static_cast<uint32_t>(payload - reinterpret_cast<uintptr_t>(obj));
+
+    *(ObjectHeader *)obj = {size, offset, ref_stride, static_cast<uint32_t>(align), false};
+    objects.emplace_back(obj);
+
+    heap_bytes += offset + size;
+    stats.bytes_allocated += offset + size;
+    return obj + offset;
+}
+
+std::vector<ObjectHeader *> Heap::Objects() const
+{
+    std::vector<ObjectHeader *> headers;
+    headers.reserve(objects.size());
+    for (const auto &obj : objects)
+        headers.push_back((ObjectHeader *)obj.get());
+    return headers;
+}
+
+void Heap::PrintStats(std::ostream &out, double run_time) const
+{
+    out << "GC: " << stats.collections << " collections, "
+        << stats.bytes_allocated << " bytes allocated, "
+        << stats.bytes_freed << " freed, "
+        << heap_bytes << " live" << std::endl;
+
+    double mean = stats.collections == 0 ? 0 : stats.total_pause / stats.collections;
+    double throughput = run_time > 0 ? 100 * (1 - stats.total_pause / run_time) : 100;
+    out << "GC pauses: " << stats.total_pause * 1000 << "ms total, "
+        << mean * 1000 << "ms mean, "
+        << stats.max_pause * 1000 << "ms max, "
+        << throughput << "% of run time spent in the program" << std::endl;
+}
\ No newline at end of file
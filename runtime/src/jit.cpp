@@ -0,0 +1,457 @@
+#include "jit.h"
+#include "vm.h"
+
+#if defined(__x86_64__)
+#include <sys/mman.h>
+
+// Register use in the compiled code:
+//      rbx - start of the current frame
+//      rbp - top of the stack
+//      rdi - the JitContext, written back to on exit
+//      rax, rcx, rdx, xmm0, xmm1 - scratch
+enum Reg : uint8_t
+{
+    RAX = 0,
+    RCX = 1,
+    RBX = 3,
+    RBP = 5,
+};
+
+// condition codes, added to the base opcode of jcc and setcc
+enum Cond : uint8_t
+{
+    CC_P = 0xA,
+    CC_NP = 0xB,
+    CC_E = 0x4,
+    CC_NE = 0x5,
+    CC_AE = 0x3,
+    CC_A = 0x7,
+    CC_L = 0xC,
+    CC_GE = 0xD,
+    CC_LE = 0xE,
+    CC_G = 0xF,
+};
+
+class X64Emitter
+{
+public:
+    std::vector<uint8_t> buf;
+
+    void Byte(uint8_t b) { buf.push_back(b); }
+
+    void Bytes(std::initializer_list<uint8_t> bs) { buf.insert(buf.end(), bs); }
+
+    void Int32(int32_t x)
+    {
+        for (size_t i = 0; i < 4; i++)
+            Byte(static_cast<uint8_t>(x >> (8 * i)));
+    }
+
+    void Int64(int64_t x)
+    {
+        for (size_t i = 0; i < 8; i++)
+            Byte(static_cast<uint8_t>(x >> (8 * i)));
+    }
+
+    // [base + disp32], base is rbx or rbp so no SIB byte is needed
+    void Mem(uint8_t reg, Reg base, int32_t disp)
+    {
+        Byte(0x80 | (reg << 3) | base);
+        Int32(disp);
+    }
+
+    void Load32(Reg dst, Reg base, int32_t disp) { Byte(0x8B); Mem(dst, base, disp); }
+    void Store32(Reg base, int32_t disp, Reg src) { Byte(0x89); Mem(src, base, disp); }
+    void Load64(Reg dst, Reg base, int32_t disp) { Bytes({0x48, 0x8B}); Mem(dst, base, disp); }
+    void Store64(Reg base, int32_t disp, Reg src) { Bytes({0x48, 0x89}); Mem(src, base, disp); }
+    void LoadByte(Reg dst, Reg base, int32_t disp) { Bytes({0x0F, 0xB6}); Mem(dst, base, disp); }
+    void StoreByte(Reg base, int32_t disp, Reg src) { Byte(0x88); Mem(src, base, disp); }
+    void LoadSD(uint8_t xmm, Reg base, int32_t disp) { Bytes({0xF2, 0x0F, 0x10}); Mem(xmm, base, disp); }
+    void StoreSD(Reg base, int32_t disp, uint8_t xmm) { Bytes({0xF2, 0x0F, 0x11}); Mem(xmm, base, disp); }
+
+    void StoreImm32(Reg base, int32_t disp, int32_t imm) { Byte(0xC7); Mem(0, base, disp); Int32(imm); }
+    void StoreImm8(Reg base, int32_t disp, uint8_t imm) { Byte(0xC6); Mem(0, base, disp); Byte(imm); }
+    void MovImm64(Reg dst, int64_t imm) { Bytes({0x48, static_cast<uint8_t>(0xB8 + dst)}); Int64(imm); }
+    void MovImm32(Reg dst, int32_t imm) { Byte(static_cast<uint8_t>(0xB8 + dst)); Int32(imm); }
+
+    // add rbp, n / sub rbp, -n
+    void MoveTop(int32_t n)
+    {
+        if (n > 0)
+        {
+            Bytes({0x48, 0x81, 0xC5});
+            Int32(n);
+        }
+        else if (n < 0)
+        {
+            Bytes({0x48, 0x81, 0xED});
+            Int32(-n);
+        }
+    }
+
+    // setcc al
+    void SetCC(Cond cc, Reg dst = RAX) { Bytes({0x0F, static_cast<uint8_t>(0x90 + cc), static_cast<uint8_t>(0xC0 + dst)}); }
+
+    // returns where the rel32 to patch is
+    size_t Jmp()
+    {
+        Byte(0xE9);
+        Int32(0);
+        return buf.size() - 4;
+    }
+
+    size_t Jcc(Cond cc)
+    {
+        Bytes({0x0F, static_cast<uint8_t>(0x80 + cc)});
+        Int32(0);
+        return buf.size() - 4;
+    }
+
+    void Patch(size_t at, size_t target)
+    {
+        int32_t rel = static_cast<int32_t>(target) - static_cast<int32_t>(at + 4);
+        for (size_t i = 0; i < 4; i++)
+            buf[at + i] = static_cast<uint8_t>(rel >> (8 * i));
+    }
+};
+
+static uint8_t *MapExecutable(const std::vector<uint8_t> &code)
+{
+    void *mem = mmap(nullptr, code.size(), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED)
+    {
+        std::cerr << "[RUNTIME ERROR] Unable to allocate memory for compiled code" << std::endl;
+        exit(4);
+    }
+
+    std::memcpy(mem, code.data(), code.size());
+    mprotect(mem, code.size(), PROT_READ | PROT_EXEC);
+    return static_cast<uint8_t *>(mem);
+}
+
+CompiledFunction::~CompiledFunction()
+{
+    if (code != nullptr)
+        munmap(code, size);
+}
+
+bool JIT::IsSupported()
+{
+    return true;
+}
+
+JIT::JIT(size_t num_functions) : hotness(num_functions), compiled(num_functions)
+{
+    X64Emitter e;
+    e.Bytes({0x53, 0x55});             // push rbx; push rbp
+    e.Bytes({0x48, 0x8B, 0x1F});       // mov rbx, [rdi]
+    e.Bytes({0x48, 0x8B, 0x6F, 0x08}); // mov rbp, [rdi + 8]
+    e.Bytes({0xFF, 0xE6});             // jmp rsi
+
+    entry_stub.size = e.buf.size();
+    entry_stub.code = MapExecutable(e.buf);
+    *(void **)&entry = entry_stub.code;
+}
+
+// binary ops find their right oprand on top, their left below it
+static constexpr int32_t I = INT_SIZE, D = DOUBLE_SIZE, B = BOOL_SIZE;
+
+static void IntArithmetic(X64Emitter &e, std::initializer_list<uint8_t> op)
+{
+    e.Load32(RCX, RBP, -I);
+    e.Load32(RAX, RBP, -2 * I);
+    e.Bytes(op);
+    e.Store32(RBP, -2 * I, RAX);
+    e.MoveTop(-I);
+}
+
+static void IntCompare(X64Emitter &e, Cond cc)
+{
+    e.Load32(RCX, RBP, -I);
+    e.Load32(RAX, RBP, -2 * I);
+    e.Bytes({0x39, 0xC8}); // cmp eax, ecx
+    e.SetCC(cc);
+    e.StoreByte(RBP, -2 * I, RAX);
+    e.MoveTop(B - 2 * I);
+}
+
+static void DoubleArithmetic(X64Emitter &e, uint8_t op)
+{
+    e.LoadSD(1, RBP, -D);
+    e.LoadSD(0, RBP, -2 * D);
+    e.Bytes({0xF2, 0x0F, op, 0xC1}); // <op>sd xmm0, xmm1
+    e.StoreSD(RBP, -2 * D, 0);
+    e.MoveTop(-D);
+}
+
+// unordered comparisons are false, as they are in C++, so less than
+// is done as greater than with the oprands swapped
+static void DoubleCompare(X64Emitter &e, Opcode code)
+{
+    e.LoadSD(1, RBP, -D);
+    e.LoadSD(0, RBP, -2 * D);
+
+    const uint8_t l_r[] = {0x66, 0x0F, 0x2E, 0xC1}; // ucomisd xmm0, xmm1
+    const uint8_t r_l[] = {0x66, 0x0F, 0x2E, 0xC8}; // ucomisd xmm1, xmm0
+    bool swap = code == Opcode::D_LT || code == Opcode::D_LEQ;
+    for (uint8_t b : swap ? r_l : l_r)
+        e.Byte(b);
+
+    switch (code)
+    {
+    case Opcode::D_GT:
+    case Opcode::D_LT:
+        e.SetCC(CC_A);
+        break;
+    case Opcode::D_GEQ:
+    case Opcode::D_LEQ:
+        e.SetCC(CC_AE);
+        break;
+    case Opcode::D_EQ_EQ:
+        e.SetCC(CC_E);
+        e.SetCC(CC_NP, RCX);
+        e.Bytes({0x20, 0xC8}); // and al, cl
+        break;
+    default:
+        e.SetCC(CC_NE);
+        e.SetCC(CC_P, RCX);
+        e.Bytes({0x08, 0xC8}); // or al, cl
+        break;
+    }
+
+    e.StoreByte(RBP, -2 * D, RAX);
+    e.MoveTop(B - 2 * D);
+}
+
+struct JumpPatch
+{
+    size_t at;
+    size_t target;
+};
+
+// emits the template for o, returning false if there is none
+static bool EmitOp(X64Emitter &e, const Function &f, const Op &o, std::vector<JumpPatch> &jumps)
+{
+    int32_t x = static_cast<int32_t>(o.op);
+
+    switch (o.code)
+    {
+    case Opcode::POP:
+        e.MoveTop(-x);
+        return true;
+    case Opcode::LOAD_INT:
+        e.StoreImm32(RBP, 0, f.ints[o.op]);
+        e.MoveTop(I);
+        return true;
+    case Opcode::LOAD_DOUBLE:
+    {
+        int64_t bits;
+        std::memcpy(&bits, &f.doubles[o.op], sizeof(bits));
+        e.MovImm64(RAX, bits);
+        e.Store64(RBP, 0, RAX);
+        e.MoveTop(D);
+        return true;
+    }
+    case Opcode::LOAD_BOOL:
+        e.StoreImm8(RBP, 0, f.bools[o.op]);
+        e.MoveTop(B);
+        return true;
+    case Opcode::LOAD_CHAR:
+        e.StoreImm8(RBP, 0, f.chars[o.op]);
+        e.MoveTop(CHAR_SIZE);
+        return true;
+    case Opcode::GET_INT:
+        e.Load32(RAX, RBX, x);
+        e.Store32(RBP, 0, RAX);
+        e.MoveTop(I);
+        return true;
+    case Opcode::GET_DOUBLE:
+        e.Load64(RAX, RBX, x);
+        e.Store64(RBP, 0, RAX);
+        e.MoveTop(D);
+        return true;
+    case Opcode::GET_BOOL:
+    case Opcode::GET_CHAR:
+        e.LoadByte(RAX, RBX, x);
+        e.StoreByte(RBP, 0, RAX);
+        e.MoveTop(o.code == Opcode::GET_BOOL ? B : CHAR_SIZE);
+        return true;
+    case Opcode::INT_ASSIGN:
+        e.Load32(RAX, RBP, -I);
+        e.Store32(RBX, x, RAX);
+        return true;
+    case Opcode::DOUBLE_ASSIGN:
+        e.Load64(RAX, RBP, -D);
+        e.Store64(RBX, x, RAX);
+        return true;
+    case Opcode::BOOL_ASSIGN:
+    case Opcode::CHAR_ASSIGN:
+        e.LoadByte(RAX, RBP, o.code == Opcode::BOOL_ASSIGN ? -B : -static_cast<int32_t>(CHAR_SIZE));
+        e.StoreByte(RBX, x, RAX);
+        return true;
+
+    case Opcode::GOTO_LABEL:
+    case Opcode::SET_IP:
+        jumps.push_back({e.Jmp(), o.op});
+        return true;
+    case Opcode::GOTO_LABEL_IF_FALSE:
+        e.MoveTop(-B);
+        e.Byte(0x80); // cmp byte [rbp], 0
+        e.Mem(7, RBP, 0);
+        e.Byte(0);
+        jumps.push_back({e.Jcc(CC_E), o.op});
+        return true;
+
+    case Opcode::I_ADD:
+        IntArithmetic(e, {0x01, 0xC8}); // add eax, ecx
+        return true;
+    case Opcode::I_SUB:
+        if (o.op != 0)
+        {
+            e.Byte(0xF7); // neg dword [rbp - I]
+            e.Mem(3, RBP, -I);
+            return true;
+        }
+        IntArithmetic(e, {0x29, 0xC8}); // sub eax, ecx
+        return true;
+    case Opcode::I_MUL:
+        IntArithmetic(e, {0x0F, 0xAF, 0xC1}); // imul eax, ecx
+        return true;
+    case Opcode::I_DIV:
+        IntArithmetic(e, {0x99, 0xF7, 0xF9}); // cdq; idiv ecx
+        return true;
+
+    case Opcode::D_ADD:
+        DoubleArithmetic(e, 0x58);
+        return true;
+    case Opcode::D_SUB:
+        if (o.op != 0)
+        {
+            e.Load64(RAX, RBP, -D);
+            e.Bytes({0x48, 0x0F, 0xBA, 0xF8, 0x3F}); // btc rax, 63
+            e.Store64(RBP, -D, RAX);
+            return true;
+        }
+        DoubleArithmetic(e, 0x5C);
+        return true;
+    case Opcode::D_MUL:
+        DoubleArithmetic(e, 0x59);
+        return true;
+    case Opcode::D_DIV:
+        DoubleArithmetic(e, 0x5E);
+        return true;
+
+    case Opcode::I_LT:
+        IntCompare(e, CC_L);
+        return true;
+    case Opcode::I_LEQ:
+        IntCompare(e, CC_LE);
+        return true;
+    case Opcode::I_GT:
+        IntCompare(e, CC_G);
+        return true;
+    case Opcode::I_GEQ:
+        IntCompare(e, CC_GE);
+        return true;
+    case Opcode::I_EQ_EQ:
+        IntCompare(e, CC_E);
+        return true;
+    case Opcode::I_BANG_EQ:
+        IntCompare(e, CC_NE);
+        return true;
+
+    case Opcode::D_LT:
+    case Opcode::D_LEQ:
+    case Opcode::D_GT:
+    case Opcode::D_GEQ:
+    case Opcode::D_EQ_EQ:
+    case Opcode::D_BANG_EQ:
+        DoubleCompare(e, o.code);
+        return true;
+
+    case Opcode::B_AND_AND:
+    case Opcode::B_OR_OR:
+    case Opcode::B_EQ_EQ:
+    case Opcode::B_BANG_EQ:
+        e.LoadByte(RAX, RBP, -B);
+        if (o.code == Opcode::B_AND_AND)
+            e.Byte(0x20); // and [rbp - 2B], al
+        else if (o.code == Opcode::B_OR_OR)
+            e.Byte(0x08); // or [rbp - 2B], al
+        else
+            e.Byte(0x38); // cmp [rbp - 2B], al
+        e.Mem(RAX, RBP, -2 * B);
+
+        if (o.code == Opcode::B_EQ_EQ || o.code == Opcode::B_BANG_EQ)
+        {
+            e.SetCC(o.code == Opcode::B_EQ_EQ ? CC_E : CC_NE);
+            e.StoreByte(RBP, -2 * B, RAX);
+        }
+        e.MoveTop(-B);
+        return true;
+    case Opcode::BANG:
+        e.Byte(0x80); // xor byte [rbp - B], 1
+        e.Mem(6, RBP, -B);
+        e.Byte(1);
+        return true;
+
+    default:
+        return false;
+    }
+}
+
+std::unique_ptr<CompiledFunction> JIT::Compile(const Function &f)
+{
+    X64Emitter e;
+    std::vector<size_t> offsets(f.code.size());
+    std::vector<JumpPatch> jumps;
+    std::vector<size_t> exits;
+
+    for (size_t i = 0; i < f.code.size(); i++)
+    {
+        offsets[i] = e.buf.size();
+
+        // the rest of a fused sequence is still in place after its head
+        Op o(VM::UnfusedOpcode(f.code[i].code), f.code[i].op);
+        if (!EmitOp(e, f, o, jumps))
+        {
+            e.MovImm32(RAX, static_cast<int32_t>(i));
+            exits.push_back(e.Jmp());
+        }
+    }
+
+    size_t exit = e.buf.size();
+    e.Bytes({0x48, 0x89, 0x6F, 0x08}); // mov [rdi + 8], rbp
+    e.Bytes({0x5D, 0x5B, 0xC3});       // pop rbp; pop rbx; ret
+
+    for (const auto &j : jumps)
+        e.Patch(j.at, offsets[j.target]);
+    for (size_t at : exits)
+        e.Patch(at, exit);
+
+    auto cf = std::make_unique<CompiledFunction>();
+    cf->size = e.buf.size();
+    cf->code = MapExecutable(e.buf);
+    for (size_t offset : offsets)
+        cf->native_at.push_back(cf->code + offset);
+
+    return cf;
+}
+
+#else
+
+CompiledFunction::~CompiledFunction() {}
+
+bool JIT::IsSupported()
+{
+    return false;
+}
+
+JIT::JIT(size_t num_functions) : hotness(num_functions), compiled(num_functions), entry(nullptr) {}
+
+std::unique_ptr<CompiledFunction> JIT::Compile(const Function &)
+{
+    return nullptr;
+}
+
+#endif
\ No newline at end of file
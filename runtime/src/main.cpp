@@ -1,6 +1,9 @@
 #define TEST
 #include "argparser.h"
+#include "runner.h"
+#include "sampler.h"
 #include "vm.h"
+#include <chrono>
 
 #ifdef COMPILE_FOR_TEST
 #define main not_main
@@ -9,14 +12,123 @@
 int main(int argc, char **argv)
 {
     ArgParser arg;
-    arg.AddArg({"-f"});
+    arg.AddArg({"-f", "-op-profile", "-suggest-super", "-emit-cpp", "-aot", "-max-call-depth", "-gc-threshold", "-gc-growth", "-flush", "-profile", "-profile-interval", "-trace", "-decode-trace", "-runs", "-threads", "-snapshot"});
+    arg.AddSwitch("-reg");
+    arg.AddSwitch("-jit");
+    arg.AddSwitch("-gc-stats");
     arg.ParseArgs(argc - 1, argv + 1);
 
+    // ranks the sequences of a profile collected with -op-profile
+    std::string profile = arg.GetArgVal("-suggest-super");
+    if (profile != "")
+    {
+        VM::SuggestSuperinstructions(profile, 20);
+        return 0;
+    }
+
     std::string binary = arg.GetArgVal("-f");
     VM vm = VM::DeserialiseProgram(binary);
 
+    // translates the program to C++ rather than running it
+    std::string cpp = arg.GetArgVal("-emit-cpp");
+    if (cpp != "")
+    {
+        vm.EmitCpp(cpp);
+        return 0;
+    }
+
+    // prints a trace taken of the program with -trace
+    std::string decode = arg.GetArgVal("-decode-trace");
+    if (decode != "")
+    {
+        vm.PrintTrace(decode);
+        return 0;
+    }
+
+    std::string depth = arg.GetArgVal("-max-call-depth");
+    std::string gc_threshold = arg.GetArgVal("-gc-threshold");
+    std::string gc_growth = arg.GetArgVal("-gc-growth");
+    std::string flush = arg.GetArgVal("-flush");
+
+    // what each VM running the program is set up with
+    auto configure = [&](VM &v)
+    {
+        if (depth != "")
+            v.SetMaxCallDepth(std::stoul(depth));
+        if (gc_threshold != "")
+            v.SetGCThreshold(std::stoul(gc_threshold));
+        if (gc_growth != "")
+            v.SetGCGrowth(std::stod(gc_growth));
+        if (flush != "")
+            v.SetFlushPolicy(flush);
+        if (arg.IsSwitchOn("-jit"))
+            v.EnableJIT();
+    };
+    configure(vm);
+
+    std::string module = arg.GetArgVal("-aot");
+    if (module != "")
+        vm.LoadAOT(module);
+    if (arg.IsSwitchOn("-reg"))
+        vm.UseRegisterCode();
+
+    // starts from the state the global initialisers leave, restored
+    // from the snapshot at the path given, or taken there first when
+    // there is none of this program. What the initialisers print is
+    // only printed when the snapshot is taken
+    std::string snapshot = arg.GetArgVal("-snapshot");
+    if (snapshot != "" && !vm.Restore(snapshot))
+        vm.Snapshot(snapshot);
+
+    // runs the program this many times at once, each run with a VM
+    // of its own on one of the threads
+    std::string runs = arg.GetArgVal("-runs");
+    if (runs != "")
+    {
+        std::string threads = arg.GetArgVal("-threads");
+        Runner runner(vm.program, threads == "" ? 0 : std::stoul(threads));
+        runner.Run(std::stoul(runs), [&](VM &v, size_t)
+                   {
+                       configure(v);
+                       if (snapshot != "")
+                           v.Restore(snapshot);
+                   });
+        return 0;
+    }
+
+    std::string trace = arg.GetArgVal("-trace");
+    if (trace != "")
+        vm.TraceTo(trace);
+
+    // samples the call stack, writing the folded stacks to the path
+    // given and a table of where the time went to stderr
+    std::string profile_out = arg.GetArgVal("-profile");
+    std::string profile_interval = arg.GetArgVal("-profile-interval");
+    std::unique_ptr<Sampler> sampler;
+    if (profile_out != "")
+        sampler = std::make_unique<Sampler>(vm.cs, vm.program->functions.size(), profile_interval == "" ? SAMPLER_DEF_INTERVAL : std::stoul(profile_interval));
+
     vm.Disasemble();
+    auto start = std::chrono::steady_clock::now();
+    if (sampler != nullptr)
+        sampler->Start();
     vm.ExecuteProgram();
 
+    if (sampler != nullptr)
+    {
+        sampler->Stop();
+        sampler->WriteFolded(profile_out);
+        sampler->PrintTable(std::cerr);
+    }
+
+    if (arg.IsSwitchOn("-gc-stats"))
+        vm.heap.PrintStats(std::cerr, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+
+    vm.DumpTrace();
+
+    std::string op_profile = arg.GetArgVal("-op-profile");
+    if (op_profile != "")
+        vm.DumpOpcodeProfile(op_profile);
+
     return 0;
 }
\ No newline at end of file
@@ -1,43 +1,38 @@
 #include "nativefuncimpl.h"
+#include "output.h"
+#include "stringslot.h"
 
-bool operator==(const ReturnValue &lhs, const ReturnValue &rhs)
+void PrintInt(int x)
 {
-    return lhs.data == rhs.data && lhs.size == rhs.size;
+    StdOut().WriteInt(x);
+    StdOut().EndLine();
 }
 
-bool operator!=(const ReturnValue &lhs, const ReturnValue &rhs)
+void PrintDouble(double x)
 {
-    return !operator==(lhs, rhs);
+    StdOut().WriteDouble(x);
+    StdOut().EndLine();
 }
 
-ReturnValue PrintInt(char *x)
+void PrintBool(bool x)
 {
-    std::cout << *(int *)x << std::endl;
-    return NULL_RETURN;
+    StdOut().WriteBool(x);
+    StdOut().EndLine();
 }
 
-ReturnValue PrintDouble(char *x)
+void PrintString(const char *str)
 {
-    std::cout << *(double *)x << std::endl;
-    return NULL_RETURN;
+    StdOut().Write(StringChars(str), StringLength(str));
+    StdOut().EndLine();
 }
 
-ReturnValue PrintBool(char *x)
+void PrintChar(char x)
 {
-    const char *res = *(bool *)x ? "true" : "false";
-    std::cout << res << std::endl;
-    return NULL_RETURN;
+    StdOut().WriteChar(x);
+    StdOut().EndLine();
 }
 
-ReturnValue PrintString(char *x)
+int Length(const char *str)
 {
-    int len = *(int *)(x + PTR_SIZE);
-    std::cout << std::string(*(char **)x, len) << std::endl;
-    return NULL_RETURN;
-}
-
-ReturnValue PrintChar(char *x)
-{
-    std::cout << *x << std::endl;
-    return NULL_RETURN;
-}
+    return StringLength(str);
+}
\ No newline at end of file
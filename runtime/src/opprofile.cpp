@@ -0,0 +1,82 @@
+#include "vm.h"
+#include <algorithm>
+#include <sstream>
+
+// Profiles are plain text, one sequence per line:
+//      <count> <opcode> <opcode> [<opcode>]
+static std::unordered_map<std::string, size_t> ReadOpcodeProfile(const std::string &path)
+{
+    std::unordered_map<std::string, size_t> counts;
+    std::ifstream file(path);
+    std::string line;
+
+    while (std::getline(file, line))
+    {
+        std::istringstream in(line);
+        size_t count;
+        if (!(in >> count))
+            continue;
+
+        std::string sequence;
+        std::getline(in >> std::ws, sequence);
+        counts[sequence] += count;
+    }
+
+    return counts;
+}
+
+static std::vector<std::pair<std::string, size_t>> SortByCount(const std::unordered_map<std::string, size_t> &counts)
+{
+    std::vector<std::pair<std::string, size_t>> sorted(counts.begin(), counts.end());
+    std::sort(sorted.begin(), sorted.end(), [](const auto &l, const auto &r)
+              { return l.second > r.second; });
+    return sorted;
+}
+
+void VM::DumpOpcodeProfile(const std::string &path)
+{
+#ifdef VM_PROFILE_OPCODES
+    std::unordered_map<std::string, size_t> counts = ReadOpcodeProfile(path);
+
+    for (size_t b = 0; b < NUM_OPCODES; b++)
+    {
+        for (size_t c = 0; c < NUM_OPCODES; c++)
+        {
+            size_t count = op_pairs[b * NUM_OPCODES + c];
+            if (count != 0)
+                counts[ToString(static_cast<Opcode>(b)) + " " + ToString(static_cast<Opcode>(c))] += count;
+        }
+    }
+
+    for (const auto &kv : op_triples)
+    {
+        size_t a = kv.first / (NUM_OPCODES * NUM_OPCODES);
+        size_t b = (kv.first / NUM_OPCODES) % NUM_OPCODES;
+        size_t c = kv.first % NUM_OPCODES;
+        counts[ToString(static_cast<Opcode>(a)) + " " + ToString(static_cast<Opcode>(b)) + " " + ToString(static_cast<Opcode>(c))] += kv.second;
+    }
+
+    std::ofstream file(path, std::ios::out | std::ios::trunc);
+    for (const auto &kv : SortByCount(counts))
+        file << kv.second << " " << kv.first << "\n";
+#else
+    (void)path;
+    RuntimeError("Opcode profiling requires a runtime built with VM_PROFILE_OPCODES");
+#endif
+}
+
+void VM::SuggestSuperinstructions(const std::string &path, size_t n)
+{
+    std::unordered_map<std::string, size_t> saved;
+
+    for (const auto &kv : ReadOpcodeProfile(path))
+    {
+        // the first instruction of the sequence is still dispatched
+        size_t length = std::count(kv.first.begin(), kv.first.end(), ' ') + 1;
+        saved[kv.first] = kv.second * (length - 1);
+    }
+
+    std::vector<std::pair<std::string, size_t>> sorted = SortByCount(saved);
+    for (size_t i = 0; i < n && i < sorted.size(); i++)
+        std::cout << sorted[i].second << " dispatches saved by fusing: " << sorted[i].first << std::endl;
+}
\ No newline at end of file
@@ -0,0 +1,95 @@
+#include "output.h"
+#include <cerrno>
+#include <charconv>
+#include <cstring>
+#include <unistd.h>
+
+Output::Output(int _fd) : fd(_fd), buf(new char[OUTPUT_BUFFER_SIZE])
+{
+    policy = isatty(fd) ? FlushPolicy::LINE : FlushPolicy::SIZE;
+}
+
+void Output::MakeRoom(size_t n)
+{
+    if (used + n <= capacity)
+        return;
+
+    if (policy != FlushPolicy::EXIT)
+    {
+        Flush();
+        if (n <= capacity)
+            return;
+    }
+
+    while (capacity < used + n)
+        capacity *= 2;
+    std::unique_ptr<char[]> bigger(new char[capacity]);
+    std::memcpy(bigger.get(), buf.get(), used);
+    buf = std::move(bigger);
+}
+
+void Output::Write(const char *chars, size_t n)
+{
+    MakeRoom(n);
+    std::memcpy(buf.get() + used, chars, n);
+    used += n;
+}
+
+void Output::WriteInt(int x)
+{
+    char digits[16];
+    auto res = std::to_chars(digits, digits + sizeof(digits), x);
+    Write(digits, res.ptr - digits);
+}
+
+void Output::WriteDouble(double x)
+{
+    char digits[32];
+    auto res = std::to_chars(digits, digits + sizeof(digits), x, std::chars_format::general, 6);
+    Write(digits, res.ptr - digits);
+}
+
+void Output::WriteBool(bool x)
+{
+    if (x)
+        Write("true", 4);
+    else
+        Write("false", 5);
+}
+
+void Output::WriteChar(char x)
+{
+    MakeRoom(1);
+    buf[used++] = x;
+}
+
+void Output::EndLine()
+{
+    WriteChar('\n');
+    if (policy == FlushPolicy::LINE)
+        Flush();
+}
+
+void Output::Flush()
+{
+    size_t written = 0;
+    while (written < used)
+    {
+        ssize_t n = write(fd, buf.get() + written, used - written);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            // nowhere left to report the error to
+            break;
+        }
+        written += n;
+    }
+    used = 0;
+}
+
+Output &StdOut()
+{
+    static thread_local Output out(STDOUT_FILENO);
+    return out;
+}
\ No newline at end of file
@@ -0,0 +1,312 @@
+#include "vm.h"
+
+// The register code is a load-time rewrite of the stack code. Loads of
+// locals and constants are not emitted but kept on a symbolic stack of
+// pending oprands, so the arithmetic, comparison and assignment ops
+// that consume them can name their sources directly. Anything the
+// translation does not understand flushes the pending loads back out
+// as stack ops and is copied over unchanged, so the two kinds of
+// instruction mix freely in one function
+struct PendingOprand
+{
+    oprand_t reg;
+    bool is_double;
+};
+
+struct RegisterForm
+{
+    Opcode stack_op;
+    Opcode reg_op;
+    bool is_double;
+};
+
+static const std::vector<RegisterForm> arithmetic_forms{
+    {Opcode::I_ADD, Opcode::R_I_ADD, false},
+    {Opcode::I_SUB, Opcode::R_I_SUB, false},
+    {Opcode::I_MUL, Opcode::R_I_MUL, false},
+    {Opcode::I_DIV, Opcode::R_I_DIV, false},
+    {Opcode::D_ADD, Opcode::R_D_ADD, true},
+    {Opcode::D_SUB, Opcode::R_D_SUB, true},
+    {Opcode::D_MUL, Opcode::R_D_MUL, true},
+    {Opcode::D_DIV, Opcode::R_D_DIV, true},
+};
+
+static const std::vector<RegisterForm> compare_forms{
+    {Opcode::I_LT, Opcode::R_I_LT_JUMP_IF_FALSE, false},
+    {Opcode::I_LEQ, Opcode::R_I_LEQ_JUMP_IF_FALSE, false},
+    {Opcode::I_GT, Opcode::R_I_GT_JUMP_IF_FALSE, false},
+    {Opcode::I_GEQ, Opcode::R_I_GEQ_JUMP_IF_FALSE, false},
+    {Opcode::I_EQ_EQ, Opcode::R_I_EQ_EQ_JUMP_IF_FALSE, false},
+    {Opcode::I_BANG_EQ, Opcode::R_I_BANG_EQ_JUMP_IF_FALSE, false},
+    {Opcode::D_LT, Opcode::R_D_LT_JUMP_IF_FALSE, true},
+    {Opcode::D_LEQ, Opcode::R_D_LEQ_JUMP_IF_FALSE, true},
+    {Opcode::D_GT, Opcode::R_D_GT_JUMP_IF_FALSE, true},
+    {Opcode::D_GEQ, Opcode::R_D_GEQ_JUMP_IF_FALSE, true},
+    {Opcode::D_EQ_EQ, Opcode::R_D_EQ_EQ_JUMP_IF_FALSE, true},
+    {Opcode::D_BANG_EQ, Opcode::R_D_BANG_EQ_JUMP_IF_FALSE, true},
+};
+
+static const RegisterForm *FindForm(const std::vector<RegisterForm> &forms, Opcode code)
+{
+    for (const auto &form : forms)
+    {
+        if (form.stack_op == code)
+            return &form;
+    }
+    return nullptr;
+}
+
+static bool IsJump(Opcode code)
+{
+    switch (code)
+    {
+    case Opcode::GOTO_LABEL:
+    case Opcode::GOTO_LABEL_IF_FALSE:
+    case Opcode::SET_IP:
+        return true;
+    default:
+        break;
+    }
+
+    for (const auto &form : compare_forms)
+    {
+        if (form.reg_op == code)
+            return true;
+    }
+    return false;
+}
+
+class RegisterTranslator
+{
+public:
+    RegisterTranslator(const std::vector<Op> &_in) : in(_in), is_target(_in.size(), false)
+    {
+        for (const Op &o : in)
+        {
+            if (IsJump(VM::UnfusedOpcode(o.code)) && o.op < in.size())
+                is_target[o.op] = true;
+        }
+    }
+
+    // new_index is filled in with each stack op's offset in the
+    // register code
+    std::vector<Op> Translate(std::vector<oprand_t> &new_index)
+    {
+        new_index.assign(in.size(), 0);
+
+        for (i = 0; i < in.size(); i++)
+        {
+            if (is_target[i])
+                Flush();
+            new_index[i] = static_cast<oprand_t>(out.size());
+
+            Op o(VM::UnfusedOpcode(in[i].code), in[i].op);
+            if (!TranslateOp(o))
+            {
+                Flush();
+                out.push_back(o);
+            }
+        }
+        Flush();
+
+        // branch targets are still indices into the stack code
+        for (Op &o : out)
+        {
+            if (IsJump(o.code))
+                o.op = new_index[o.op];
+        }
+
+        return out;
+    }
+
+private:
+    const std::vector<Op> &in;
+    std::vector<bool> is_target;
+    std::vector<Op> out;
+    std::vector<PendingOprand> pending;
+    size_t i = 0;
+
+    void Flush()
+    {
+        for (const auto &p : pending)
+        {
+            bool is_const = (p.reg & REG_CONST) != 0;
+            Opcode load = p.is_double ? (is_const ? Opcode::LOAD_DOUBLE : Opcode::GET_DOUBLE)
+                                      : (is_const ? Opcode::LOAD_INT : Opcode::GET_INT);
+            out.push_back(Op(load, p.reg & ~REG_CONST));
+        }
+        pending.clear();
+    }
+
+    // the op 'n' after the current one, if control can only reach
+    // it by falling through
+    bool Follows(size_t n, Opcode code)
+    {
+        for (size_t j = 1; j <= n; j++)
+        {
+            if (i + j >= in.size() || is_target[i + j])
+                return false;
+        }
+        return VM::UnfusedOpcode(in[i + n].code) == code;
+    }
+
+    // source for the next value off the stack, a pending oprand of the
+    // right type or the real stack once those run out
+    bool TakeOprand(bool is_double, oprand_t &reg)
+    {
+        if (pending.empty())
+        {
+            reg = REG_STACK;
+            return true;
+        }
+
+        if (pending.back().is_double != is_double)
+            return false;
+
+        reg = pending.back().reg;
+        pending.pop_back();
+        return true;
+    }
+
+    // 'x = l op r;' is compiled to the op followed by an assignment
+    // that leaves its value on the stack for the statement to pop
+    oprand_t AssignedSlot(bool is_double, size_t n)
+    {
+        Opcode assign = is_double ? Opcode::DOUBLE_ASSIGN : Opcode::INT_ASSIGN;
+        oprand_t size = is_double ? DOUBLE_SIZE : INT_SIZE;
+        if (Follows(n, assign) && Follows(n + 1, Opcode::POP) && in[i + n + 1].op == size)
+            return in[i + n].op;
+        return REG_STACK;
+    }
+
+    bool TranslateOp(const Op &o)
+    {
+        switch (o.code)
+        {
+        case Opcode::GET_INT:
+            pending.push_back({o.op, false});
+            return true;
+        case Opcode::LOAD_INT:
+            pending.push_back({REG_CONST | o.op, false});
+            return true;
+        case Opcode::GET_DOUBLE:
+            pending.push_back({o.op, true});
+            return true;
+        case Opcode::LOAD_DOUBLE:
+            pending.push_back({REG_CONST | o.op, true});
+            return true;
+        case Opcode::INT_ASSIGN:
+        case Opcode::DOUBLE_ASSIGN:
+            return TranslateAssign(o);
+        default:
+            break;
+        }
+
+        // the stack code marks unary minus with a non-zero oprand
+        const RegisterForm *form = FindForm(arithmetic_forms, o.code);
+        if (form != nullptr && o.op == 0)
+            return TranslateArithmetic(*form);
+
+        form = FindForm(compare_forms, o.code);
+        if (form != nullptr && Follows(1, Opcode::GOTO_LABEL_IF_FALSE))
+            return TranslateCompareJump(*form);
+
+        return false;
+    }
+
+    bool TranslateAssign(const Op &o)
+    {
+        bool is_double = o.code == Opcode::DOUBLE_ASSIGN;
+        if (pending.empty() || pending.back().is_double != is_double || AssignedSlot(is_double, 0) == REG_STACK)
+            return false;
+
+        oprand_t src = pending.back().reg;
+        pending.pop_back();
+
+        Flush();
+        out.push_back(Op(is_double ? Opcode::R_D_MOV : Opcode::R_I_MOV, o.op));
+        out.push_back(Op(Opcode::NONE, src));
+        i++;
+        return true;
+    }
+
+    bool TranslateArithmetic(const RegisterForm &form)
+    {
+        // nothing to gain when both oprands are already on the stack
+        if (pending.empty())
+            return false;
+
+        std::vector<PendingOprand> saved = pending;
+        oprand_t r, l;
+        if (!TakeOprand(form.is_double, r) || !TakeOprand(form.is_double, l))
+        {
+            pending = saved;
+            return false;
+        }
+
+        // anything still pending sits below the result on the stack, and
+        // a slot write must not overtake a pending read of that slot
+        Flush();
+
+        oprand_t dest = AssignedSlot(form.is_double, 1);
+        if (dest != REG_STACK)
+            i += 2;
+
+        out.push_back(Op(form.reg_op, dest));
+        out.push_back(Op(Opcode::NONE, l));
+        out.push_back(Op(Opcode::NONE, r));
+        return true;
+    }
+
+    bool TranslateCompareJump(const RegisterForm &form)
+    {
+        if (pending.empty())
+            return false;
+
+        std::vector<PendingOprand> saved = pending;
+        oprand_t r, l;
+        if (!TakeOprand(form.is_double, r) || !TakeOprand(form.is_double, l))
+        {
+            pending = saved;
+            return false;
+        }
+
+        Flush();
+
+        i++;
+        out.push_back(Op(form.reg_op, in[i].op));
+        out.push_back(Op(Opcode::NONE, l));
+        out.push_back(Op(Opcode::NONE, r));
+        return true;
+    }
+};
+
+std::vector<oprand_t> VM::TranslateToRegisterCode(Function &f)
+{
+    std::vector<oprand_t> new_index;
+    f.code = RegisterTranslator(f.code).Translate(new_index);
+    return new_index;
+}
+
+void VM::UseRegisterCode()
+{
+    Program &p = ProgramToChange();
+    p.register_code = true;
+#ifdef VM_TRACE
+    tracer.register_code = true;
+#endif
+
+    for (size_t i = 0; i < p.functions.size(); i++)
+    {
+        std::vector<oprand_t> new_index = TranslateToRegisterCode(p.functions[i]);
+
+        // a try block's code is still one range, as the
+        // translation keeps the ops in order
+        for (ThrowInfo &ti : p.exception_tables[i])
+        {
+            ti.begin = new_index[ti.begin];
+            ti.end = new_index[ti.end];
+            ti.index = new_index[ti.index];
+        }
+    }
+}
\ No newline at end of file
@@ -0,0 +1,39 @@
+#include "runner.h"
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+Runner::Runner(std::shared_ptr<Program> _program, size_t _num_threads)
+    : program(std::move(_program)), num_threads(_num_threads)
+{
+    if (num_threads == 0)
+        num_threads = std::max(1U, std::thread::hardware_concurrency());
+}
+
+void Runner::Run(size_t count, const std::function<void(VM &, size_t)> &setup)
+{
+    // the only thing the threads share, each takes the next run from it
+    std::atomic<size_t> next{0};
+
+    auto work = [&]()
+    {
+        for (size_t i = next++; i < count; i = next++)
+        {
+            VM vm(program);
+            if (setup)
+                setup(vm, i);
+            vm.ExecuteProgram();
+        }
+        StdOut().Flush();
+    };
+
+    std::vector<std::thread> threads;
+    for (size_t t = 1; t < std::min(num_threads, count); t++)
+        threads.emplace_back(work);
+
+    // the calling thread takes runs too
+    work();
+    for (auto &t : threads)
+        t.join();
+}
\ No newline at end of file
@@ -0,0 +1,159 @@
+#include "sampler.h"
+#include <algorithm>
+#include <csignal>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <vector>
+
+// the handler has nowhere else to find the sampler
+static Sampler *volatile active = nullptr;
+
+Sampler::Sampler(const CallStack &_cs, size_t _num_functions, unsigned _interval)
+    : cs(_cs), num_functions(_num_functions), interval(_interval), buf(new oprand_t[SAMPLER_BUFFER_SIZE]) {}
+
+void Sampler::OnSignal(int)
+{
+    Sampler *s = active;
+    if (s != nullptr)
+        s->Record();
+}
+
+// runs in the signal handler, so must not allocate or lock. The call
+// stack may be part way through a call or return, which at worst
+// gives one sample with a frame too few or too many
+void Sampler::Record()
+{
+    size_t depth = cs.Size();
+    if (used + depth + 1 > SAMPLER_BUFFER_SIZE)
+    {
+        dropped++;
+        return;
+    }
+
+    buf[used++] = static_cast<oprand_t>(depth);
+    for (const CallFrame *cf = cs.begin(); cf != cs.begin() + depth; cf++)
+        buf[used++] = cf->function;
+    samples++;
+}
+
+void Sampler::Start()
+{
+    active = this;
+
+    struct sigaction sa = {};
+    sa.sa_handler = OnSignal;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGPROF, &sa, nullptr);
+
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &started);
+
+    sigevent ev = {};
+    ev.sigev_notify = SIGEV_SIGNAL;
+    ev.sigev_signo = SIGPROF;
+    timer_create(CLOCK_PROCESS_CPUTIME_ID, &ev, &timer);
+
+    itimerspec spec = {};
+    spec.it_interval.tv_sec = interval / 1000000;
+    spec.it_interval.tv_nsec = interval % 1000000 * 1000;
+    spec.it_value = spec.it_interval;
+    timer_settime(timer, 0, &spec, nullptr);
+}
+
+void Sampler::Stop()
+{
+    if (active != this)
+        return;
+
+    timer_delete(timer);
+    timespec stopped;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &stopped);
+    cpu_time = (stopped.tv_sec - started.tv_sec) + (stopped.tv_nsec - started.tv_nsec) / 1e9;
+
+    // a signal still pending would otherwise end the process
+    signal(SIGPROF, SIG_IGN);
+    active = nullptr;
+}
+
+static std::string FunctionName(oprand_t function)
+{
+    // function 0 initialises the globals and calls Main
+    if (function == 0)
+        return "<init>";
+    return "f" + std::to_string(function);
+}
+
+void Sampler::WriteFolded(const std::string &path) const
+{
+    std::map<std::vector<oprand_t>, size_t> stacks;
+    for (size_t i = 0; i < used; i += buf[i] + 1)
+        stacks[std::vector<oprand_t>(&buf[i + 1], &buf[i + 1] + buf[i])]++;
+
+    std::ofstream file(path);
+    for (const auto &[stack, count] : stacks)
+    {
+        for (size_t i = 0; i < stack.size(); i++)
+            file << (i == 0 ? "" : ";") << FunctionName(stack[i]);
+        file << " " << count << "\n";
+    }
+}
+
+void Sampler::PrintTable(std::ostream &out) const
+{
+    std::vector<size_t> self(num_functions, 0), total(num_functions, 0);
+    // the last sample each function was counted in, so that
+    // recursion does not count a sample more than once
+    std::vector<size_t> seen(num_functions, SIZE_MAX);
+
+    size_t sample = 0;
+    for (size_t i = 0; i < used; i += buf[i] + 1, sample++)
+    {
+        for (size_t j = 1; j <= buf[i]; j++)
+        {
+            oprand_t f = buf[i + j];
+            if (f >= num_functions || seen[f] == sample)
+                continue;
+            seen[f] = sample;
+            total[f]++;
+        }
+
+        if (buf[i] != 0 && buf[i + buf[i]] < num_functions)
+            self[buf[i + buf[i]]]++;
+    }
+
+    std::vector<oprand_t> order;
+    for (oprand_t f = 0; f < num_functions; f++)
+    {
+        if (total[f] != 0)
+            order.push_back(f);
+    }
+    std::sort(order.begin(), order.end(), [&](oprand_t l, oprand_t r)
+              { return self[l] != self[r] ? self[l] > self[r] : total[l] > total[r]; });
+
+    std::streamsize precision = out.precision();
+    out << std::fixed << std::setprecision(1)
+        << "Profile: " << samples << " samples over " << cpu_time * 1000 << "ms of CPU time";
+    if (dropped != 0)
+        out << ", " << dropped << " dropped once the buffer filled";
+    out << std::endl;
+
+    // the timer may fire less often than asked for, when the kernel
+    // only accounts CPU time every tick, so the samples are taken as
+    // shares of the CPU time measured rather than as intervals
+    auto ms = [&](size_t n)
+    { return samples == 0 ? 0 : cpu_time * 1000 * n / samples; };
+    auto percent = [&](size_t n)
+    { return samples == 0 ? 0 : 100.0 * n / samples; };
+
+    out << std::setw(12) << "self ms" << std::setw(8) << "self%"
+        << std::setw(12) << "total ms" << std::setw(8) << "total%" << "  function" << std::endl;
+    for (oprand_t f : order)
+    {
+        out << std::setw(12) << ms(self[f]) << std::setw(8) << percent(self[f])
+            << std::setw(12) << ms(total[f]) << std::setw(8) << percent(total[f])
+            << "  " << FunctionName(f) << std::endl;
+    }
+    out << std::defaultfloat << std::setprecision(precision);
+}
\ No newline at end of file
@@ -0,0 +1,173 @@
+#include "snapshot.h"
+#include "stringslot.h"
+#include "vm.h"
+#include <algorithm>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// a range of addresses as they were when the snapshot was
+// taken, and where it starts now
+struct MovedRange
+{
+    uint64_t begin;
+    uint64_t end;
+    char *now;
+};
+
+// rewrites the address at slot if it was inside one of the ranges.
+// Only called on slots known to hold an address, as anything else
+// could read as one
+static void Relocate(char *slot, const std::vector<MovedRange> &moved)
+{
+    uint64_t addr;
+    std::memcpy(&addr, slot, sizeof(addr));
+
+    auto it = std::upper_bound(moved.begin(), moved.end(), addr,
+                               [](uint64_t a, const MovedRange &r)
+                               { return a < r.begin; });
+    if (it == moved.begin() || addr >= (it - 1)->end)
+        return;
+
+    char *now = (it - 1)->now + (addr - (it - 1)->begin);
+    std::memcpy(slot, &now, sizeof(now));
+}
+
+// an inline string's chars are in the slot rather than an address
+static void RelocateString(char *slot, const std::vector<MovedRange> &moved)
+{
+    if (!IsInlineString(slot))
+        Relocate(slot, moved);
+}
+
+void VM::Snapshot(const std::string &path)
+{
+    if (cur_func == MAX_OPRAND)
+        return;
+
+    Initialise();
+    // the stack is untyped, so there would be no telling what on it
+    // is an address
+    if (stack.GetSize() != 0)
+        RuntimeError("Cannot snapshot a program that leaves values on the stack before calling Main");
+    // only what the initialisers left reachable is kept
+    Collect();
+
+    std::vector<ObjectHeader *> objects = heap.Objects();
+    SnapshotHeader header{SNAPSHOT_MAGIC, 0, program->fingerprint,
+                          reinterpret_cast<uint64_t>(program->strings.Begin()), program->strings.Size(),
+                          globals.GetSize(), objects.size()};
+
+    std::ofstream file(path, std::ios::binary);
+    if (!file)
+        RuntimeError("Unable to write a snapshot to '" + path + "'");
+
+    file.write((const char *)&header, sizeof(header));
+    file.write(globals.GetBegin(), globals.GetSize());
+    for (ObjectHeader *h : objects)
+    {
+        const char *payload = (const char *)h + h->offset;
+        uint32_t prefix = h->offset - sizeof(ObjectHeader);
+        SnapshotObject obj{reinterpret_cast<uint64_t>(payload), h->size, prefix, h->ref_stride, h->align, 0};
+        file.write((const char *)&obj, sizeof(obj));
+        file.write(payload - prefix, prefix + h->size);
+    }
+
+    if (!file)
+        RuntimeError("Unable to write a snapshot to '" + path + "'");
+}
+
+bool VM::Restore(const std::string &path)
+{
+    if (cur_func == MAX_OPRAND)
+        return false;
+
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(SnapshotHeader))
+    {
+        close(fd);
+        return false;
+    }
+
+    size_t length = st.st_size;
+    void *map = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return false;
+
+    const char *p = (const char *)map;
+    const char *end = p + length;
+    // copies the next n bytes out, false if the file ends first
+    auto read = [&p, end](void *dest, size_t n)
+    {
+        if (static_cast<size_t>(end - p) < n)
+            return false;
+        std::memcpy(dest, p, n);
+        p += n;
+        return true;
+    };
+
+    SnapshotHeader header;
+    read(&header, sizeof(header));
+    bool ok = header.magic == SNAPSHOT_MAGIC &&
+              header.fingerprint == program->fingerprint &&
+              header.strings_size == program->strings.Size() &&
+              header.globals_size == globals.GetSize();
+
+    ok = ok && read(globals.GetBegin(), header.globals_size);
+
+    std::vector<MovedRange> moved;
+    if (header.strings_size != 0)
+        moved.push_back({header.strings_begin, header.strings_begin + header.strings_size, (char *)program->strings.Begin()});
+
+    // objects that may refer to others, as their payloads now are
+    std::vector<std::pair<char *, SnapshotObject>> with_refs;
+    for (uint64_t i = 0; ok && i < header.num_objects; i++)
+    {
+        SnapshotObject obj;
+        ok = read(&obj, sizeof(obj));
+        if (!ok)
+            break;
+
+        char *payload = heap.Allocate(obj.size, obj.ref_stride, obj.prefix, obj.align);
+        ok = read(payload - obj.prefix, obj.prefix + obj.size);
+        moved.push_back({obj.payload - obj.prefix, obj.payload + obj.size, payload - obj.prefix});
+        if (obj.ref_stride != 0)
+            with_refs.push_back({payload, obj});
+    }
+    munmap(map, length);
+
+    if (!ok)
+    {
+        // what was loaded is garbage now
+        globals = Globals(program->global_data);
+        Collect();
+        return false;
+    }
+
+    std::sort(moved.begin(), moved.end(),
+              [](const MovedRange &a, const MovedRange &b)
+              { return a.begin < b.begin; });
+    for (oprand_t offset : program->global_refs.strings)
+        RelocateString(globals.GetBegin() + offset, moved);
+    for (oprand_t offset : program->global_refs.pointers)
+        Relocate(globals.GetBegin() + offset, moved);
+    // each element of an array that holds references starts with an
+    // address, and only arrays of strings have elements that wide
+    for (auto &[payload, obj] : with_refs)
+        for (size_t i = 0; i + obj.ref_stride <= obj.size; i += obj.ref_stride)
+        {
+            if (obj.ref_stride == STRING_SIZE)
+                RelocateString(payload + i, moved);
+            else
+                Relocate(payload + i, moved);
+        }
+
+    ip = program->MainCall();
+    return true;
+}
\ No newline at end of file
@@ -1,10 +1,12 @@
 #include "stack.h"
 
+// new[] returns storage aligned for any fundamental type, so with
+// UNIFORM_SLOTS every slot offset is 8 byte aligned
 Stack::Stack()
 {
     data = new char[DEF_SIZE * sizeof(char)];
     top = data;
-    size = 0;
+    frame = data;
     capacity = DEF_SIZE;
 }
 
@@ -13,15 +15,17 @@ Stack::~Stack()
     delete[] data;
 }
 
-void Stack::GrowIfUnableToPush(const size_t n)
+void Stack::Grow(const oprand_t bytes)
 {
-    if (size + n < capacity)
-        return;
+    oprand_t size = GetSize();
+    while (bytes > capacity - size)
+        capacity *= GROW_FAC;
 
-    capacity *= 2;
     char *old = data;
 
     data = new char[capacity];
     std::memcpy(data, old, size);
+    top = data + size;
+    frame = data + (frame - old);
     delete[] old;
 }
\ No newline at end of file
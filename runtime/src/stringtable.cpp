@@ -0,0 +1,30 @@
+#include "stringtable.h"
+#include <cstring>
+#include <unordered_map>
+
+StringTable::StringTable(const std::vector<Function> &functions)
+{
+    // where each distinct string starts in the block
+    std::unordered_map<std::string, size_t> offsets;
+    for (const auto &f : functions)
+    {
+        for (const auto &str : f.strings)
+        {
+            if (offsets.emplace(str, size).second)
+                size += str.length();
+        }
+    }
+
+    block = std::make_unique<char[]>(size);
+    for (const auto &kv : offsets)
+        std::memcpy(block.get() + kv.second, kv.first.data(), kv.first.length());
+
+    // the stack holds strings as mutable pointers, but nothing
+    // writes through one that points into the block
+    for (const auto &f : functions)
+    {
+        constants.emplace_back();
+        for (const auto &str : f.strings)
+            constants.back().push_back({block.get() + offsets[str], static_cast<int>(str.length())});
+    }
+}
\ No newline at end of file
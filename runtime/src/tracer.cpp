@@ -0,0 +1,109 @@
+#include "vm.h"
+#include <cerrno>
+#include <csignal>
+#include <fcntl.h>
+#include <iomanip>
+#include <unistd.h>
+
+static bool WriteAll(int fd, const void *data, size_t n)
+{
+    const char *bytes = static_cast<const char *>(data);
+    while (n > 0)
+    {
+        ssize_t written = write(fd, bytes, n);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        bytes += written;
+        n -= written;
+    }
+    return true;
+}
+
+bool Tracer::Dump() const
+{
+    uint64_t n = total;
+    uint64_t kept = n < mask + 1 ? n : mask + 1;
+    TraceHeader header{TRACE_MAGIC, register_code, n, kept};
+
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return false;
+
+    // the oldest entry is the one the next op overwrites
+    size_t oldest = (n - kept) & mask;
+    size_t first = kept < mask + 1 - oldest ? kept : mask + 1 - oldest;
+    bool ok = WriteAll(fd, &header, sizeof(header)) &&
+              WriteAll(fd, &entries[oldest], first * sizeof(TraceEntry)) &&
+              WriteAll(fd, &entries[0], (kept - first) * sizeof(TraceEntry));
+    close(fd);
+    return ok;
+}
+
+#ifdef VM_TRACE
+// the handler has nowhere else to find the trace
+static Tracer *volatile traced = nullptr;
+
+static void DumpOnSignal(int)
+{
+    if (traced != nullptr)
+        traced->Dump();
+}
+#endif
+
+void VM::TraceTo(const std::string &path)
+{
+#ifdef VM_TRACE
+    tracer.path = path;
+    tracer.register_code = program->register_code;
+    traced = &tracer;
+
+    struct sigaction sa = {};
+    sa.sa_handler = DumpOnSignal;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGUSR1, &sa, nullptr);
+#else
+    (void)path;
+    RuntimeError("Tracing requires a runtime built with VM_TRACE");
+#endif
+}
+
+void VM::DumpTrace()
+{
+#ifdef VM_TRACE
+    if (tracer.path != "" && !tracer.Dump())
+        std::cerr << "Unable to write the trace to '" << tracer.path << "'" << std::endl;
+#endif
+}
+
+void VM::PrintTrace(const std::string &path)
+{
+    std::ifstream file(path, std::ios::binary);
+    TraceHeader header;
+    if (!file.read((char *)&header, sizeof(header)) || header.magic != TRACE_MAGIC)
+        RuntimeError("'" + path + "' is not a trace");
+
+    if (header.register_code)
+        UseRegisterCode();
+
+    std::cout << header.total << " ops executed, the last " << header.num_entries << " of them traced" << std::endl;
+
+    // numbered from the start of the program
+    uint64_t seq = header.total - header.num_entries;
+    TraceEntry e;
+    while (file.read((char *)&e, sizeof(e)))
+    {
+        std::cout << std::setw(12) << seq++ << "  f" << std::left << std::setw(4) << e.function
+                  << std::right << std::setw(6) << e.ip << "  [" << std::setw(6) << e.stack_size << "]  ";
+
+        // the op as it ran, with the oprand from the code to annotate it
+        if (e.function < program->functions.size() && e.ip < program->functions[e.function].code.size())
+            program->functions[e.function].PrintOp(Op(e.code, program->functions[e.function].code[e.ip].op));
+        else
+            std::cout << ToString(e.code) << " (not in this program)" << std::endl;
+    }
+}
\ No newline at end of file
@@ -1,719 +1,1426 @@
 #include "vm.h"
 
-VM::VM(std::vector<Function> &_functions, oprand_t mainIndex,
-       std::unordered_map<oprand_t, std::unordered_set<oprand_t>> &_StructTree,
-       std::vector<LibraryFunctionDef> &_syms,
-       std::vector<ThrowInfo> &_throwInfos)
+Program::Program(std::vector<Function> &_functions, oprand_t mainIndex,
+                 std::unordered_map<oprand_t, std::unordered_set<oprand_t>> &_StructTree,
+                 std::vector<LibraryFunctionDef> &_syms,
+                 std::vector<ThrowInfo> &_throwInfos,
+                 const std::vector<char> &_global_data,
+                 const GlobalRefs &_global_refs)
 {
     functions = _functions;
+    global_data = _global_data;
+    global_refs = _global_refs;
+
+    // function 0 calls Main once it has initialised the globals
+    // that could not be written into the data section, from the end
+    // of its last routine, which is the one it runs off the end of
+    if (mainIndex != MAX_OPRAND)
+        functions[0].routines.back().push_back(Op(Opcode::CALL_F, mainIndex));
+
+    std::vector<std::vector<oprand_t>> routine_starts;
+    for (auto &f : functions)
+    {
+        routine_starts.push_back(VM::LinkFunction(f));
+#ifndef VM_PROFILE_OPCODES
+        // profiles are gathered over the unfused code
+        VM::FuseSuperinstructions(f);
+#endif
+    }
+
+    fingerprint = ProgramFingerprint(functions, global_data);
+    strings = StringTable(functions);
     struct_tree = _StructTree;
-    throw_infos = _throwInfos;
 
+    // the compiler adds a try block after those nested in it,
+    // so each table is in the order a throw searches it
+    exception_tables.resize(functions.size());
+    for (ThrowInfo ti : _throwInfos)
+    {
+        const std::vector<oprand_t> &routine_start = routine_starts[ti.func];
+        ti.begin = routine_start[ti.begin];
+        ti.end = routine_start[ti.end];
+        ti.index = routine_start[ti.index];
+        exception_tables[ti.func].push_back(ti);
+    }
+
+    // every library function is resolved up front, so a call is
+    // just an index into lib_calls
+    std::unordered_map<std::string, void *> opened;
     for (auto &lf : _syms)
     {
-        std::string libpath = "./lib/lib" + lf.library + ".so";
-        void *handle = dlopen(libpath.c_str(), RTLD_NOW);
-        lib_handles.push_back(handle);
+        void *&handle = opened[lf.library];
+        if (handle == nullptr)
+        {
+            std::string libpath = "./lib/lib" + lf.library + ".so";
+            handle = dlopen(libpath.c_str(), RTLD_NOW);
+            if (handle == nullptr)
+                VM::Abort("Unable to load library '" + libpath + "': " + dlerror());
+            lib_handles.push_back(handle);
+        }
 
         LibFunc func;
         *(void **)&func = dlsym(handle, lf.name.c_str());
-        CLibs.push_back({func, lf.arity});
+        if (func == nullptr)
+            VM::Abort("Unable to find '" + lf.name + "' in library '" + lf.library + "'");
+        lib_calls.push_back({func, static_cast<oprand_t>(lf.arg_size), static_cast<oprand_t>(lf.ret_size)});
     }
 
-    cur_func = mainIndex == UINT8_MAX ? UINT8_MAX : 0;
-    cs.push_back({0, 0, 0});
-    cs.push_back({0, mainIndex, 0});
-    cur_cf = &cs.back();
+    has_main = mainIndex != MAX_OPRAND;
+}
+
+Program::~Program()
+{
+    for (void *handle : lib_handles)
+        dlclose(handle);
+}
+
+VM::VM(std::shared_ptr<Program> _program) : program(std::move(_program)), globals(program->global_data)
+{
+    cur_func = program->has_main ? 0 : MAX_OPRAND;
+    stack.Reserve(program->functions[0].max_stack);
 
     ip = 0;
-    cur_routine = 0;
+}
+
+Program &VM::ProgramToChange()
+{
+    if (program.use_count() > 1)
+        RuntimeError("The program cannot be changed once other VMs share it");
+    return *program;
+}
+
+
+std::vector<oprand_t> VM::LinkFunction(Function &f)
+{
+    // offset of each routine in the flattened code
+    std::vector<oprand_t> routine_start;
+    oprand_t offset = 0;
+
+    for (auto &routine : f.routines)
+    {
+        routine_start.push_back(offset);
+        offset += routine.size();
+        if (!EndsRoutine(routine))
+            offset++;
+    }
+
+    f.code.clear();
+    f.code.reserve(offset);
+
+    for (size_t i = 0; i < f.routines.size(); i++)
+    {
+        for (Op o : f.routines[i])
+        {
+            if (o.code == Opcode::GOTO_LABEL || o.code == Opcode::GOTO_LABEL_IF_FALSE)
+                o.op = routine_start[o.op];
+            else if (o.code == Opcode::SET_IP)
+                o.op += routine_start[i];
+
+            f.code.push_back(o);
+        }
+
+        // running off the end of a routine is an implicit return
+        if (!EndsRoutine(f.routines[i]))
+            f.code.push_back(Op(Opcode::RETURN_VOID, 0));
+    }
+
+    f.routines.clear();
+    return routine_start;
+}
+
+// Each superinstruction replaces the first op of its pattern. The
+// rest of the pattern is left in place, so the fused handler reads
+// their oprands from the following ops and skips over them, and a
+// branch into the middle of a fused sequence still runs the
+// original instructions. The patterns are the hottest sequences in
+// the profiles collected with VM_PROFILE_OPCODES
+struct Superinstruction
+{
+    Opcode fused;
+    std::vector<Opcode> pattern;
+};
+
+static const std::vector<Superinstruction> superinstructions{
+    {Opcode::INT_ADD_ASSIGN, {Opcode::GET_INT, Opcode::GET_INT, Opcode::I_ADD, Opcode::INT_ASSIGN, Opcode::POP}},
+    {Opcode::INT_ADD_CONST_ASSIGN, {Opcode::GET_INT, Opcode::LOAD_INT, Opcode::I_ADD, Opcode::INT_ASSIGN, Opcode::POP}},
+    {Opcode::INT_LT_JUMP_IF_FALSE, {Opcode::GET_INT, Opcode::GET_INT, Opcode::I_LT, Opcode::GOTO_LABEL_IF_FALSE}},
+    {Opcode::INT_LEQ_JUMP_IF_FALSE, {Opcode::GET_INT, Opcode::GET_INT, Opcode::I_LEQ, Opcode::GOTO_LABEL_IF_FALSE}},
+    {Opcode::INT_GT_JUMP_IF_FALSE, {Opcode::GET_INT, Opcode::GET_INT, Opcode::I_GT, Opcode::GOTO_LABEL_IF_FALSE}},
+    {Opcode::INT_GEQ_JUMP_IF_FALSE, {Opcode::GET_INT, Opcode::GET_INT, Opcode::I_GEQ, Opcode::GOTO_LABEL_IF_FALSE}},
+    {Opcode::INT_EQ_EQ_JUMP_IF_FALSE, {Opcode::GET_INT, Opcode::GET_INT, Opcode::I_EQ_EQ, Opcode::GOTO_LABEL_IF_FALSE}},
+    {Opcode::INT_BANG_EQ_JUMP_IF_FALSE, {Opcode::GET_INT, Opcode::GET_INT, Opcode::I_BANG_EQ, Opcode::GOTO_LABEL_IF_FALSE}},
+    {Opcode::INT_LT_CONST_JUMP_IF_FALSE, {Opcode::GET_INT, Opcode::LOAD_INT, Opcode::I_LT, Opcode::GOTO_LABEL_IF_FALSE}},
+    {Opcode::INT_LEQ_CONST_JUMP_IF_FALSE, {Opcode::GET_INT, Opcode::LOAD_INT, Opcode::I_LEQ, Opcode::GOTO_LABEL_IF_FALSE}},
+    {Opcode::INT_GT_CONST_JUMP_IF_FALSE, {Opcode::GET_INT, Opcode::LOAD_INT, Opcode::I_GT, Opcode::GOTO_LABEL_IF_FALSE}},
+    {Opcode::INT_GEQ_CONST_JUMP_IF_FALSE, {Opcode::GET_INT, Opcode::LOAD_INT, Opcode::I_GEQ, Opcode::GOTO_LABEL_IF_FALSE}},
+    {Opcode::INT_EQ_EQ_CONST_JUMP_IF_FALSE, {Opcode::GET_INT, Opcode::LOAD_INT, Opcode::I_EQ_EQ, Opcode::GOTO_LABEL_IF_FALSE}},
+    {Opcode::INT_BANG_EQ_CONST_JUMP_IF_FALSE, {Opcode::GET_INT, Opcode::LOAD_INT, Opcode::I_BANG_EQ, Opcode::GOTO_LABEL_IF_FALSE}},
+    {Opcode::GET_INT_GET_INT, {Opcode::GET_INT, Opcode::GET_INT}},
+};
+
+static bool MatchesPattern(const std::vector<Op> &code, size_t i, const std::vector<Opcode> &pattern)
+{
+    if (i + pattern.size() > code.size())
+        return false;
+
+    for (size_t j = 0; j < pattern.size(); j++)
+    {
+        if (code[i + j].code != pattern[j])
+            return false;
+    }
+
+    // an assignment's result must be popped as an int for
+    // the fused op to leave the stack as it found it
+    if (pattern.back() == Opcode::POP)
+        return code[i + pattern.size() - 1].op == INT_SIZE;
+
+    return true;
+}
+
+void VM::FuseSuperinstructions(Function &f)
+{
+    size_t i = 0;
+    while (i < f.code.size())
+    {
+        size_t matched = 1;
+        for (const auto &si : superinstructions)
+        {
+            if (MatchesPattern(f.code, i, si.pattern))
+            {
+                f.code[i].code = si.fused;
+                matched = si.pattern.size();
+                break;
+            }
+        }
+        i += matched;
+    }
+}
+
+Opcode VM::UnfusedOpcode(Opcode code)
+{
+    for (const auto &si : superinstructions)
+    {
+        if (si.fused == code)
+            return si.pattern[0];
+    }
+    return code;
+}
+
+bool VM::EndsRoutine(const std::vector<Op> &routine)
+{
+    if (routine.empty())
+        return false;
+
+    Opcode last = routine.back().code;
+    return last == Opcode::GOTO_LABEL || last == Opcode::TAIL_CALL || last == Opcode::RETURN || last == Opcode::RETURN_VOID;
 }
 
 void VM::Disasemble()
 {
-    for (size_t i = 0; i < functions.size(); i++)
+    for (size_t i = 0; i < program->functions.size(); i++)
     {
         std::cout << "Function index: " << i << std::endl
-                  << "Function arity: " << +functions[i].arity
+                  << "Function arity: " << +program->functions[i].arity
+                  << std::endl
+                  << "Function max stack: " << +program->functions[i].max_stack
                   << std::endl
                   << std::endl;
 
-        functions[i].PrintCode();
+        for (size_t j = 0; j < program->functions[i].code.size(); j++)
+        {
+            std::cout << j << "\t";
+            program->functions[i].PrintOp(program->functions[i].code[j]);
+        }
 
         std::cout << std::endl
                   << std::endl;
     }
 }
 
+void VM::EnableJIT()
+{
+    if (!JIT::IsSupported())
+        RuntimeError("The JIT compiler only generates x86-64 code");
+    jit = std::make_unique<JIT>(program->functions.size());
+}
+
+void VM::SetMaxCallDepth(size_t depth)
+{
+    if (depth == 0)
+        RuntimeError("The call stack needs room for at least one frame");
+    cs.SetCapacity(depth);
+}
+
+void VM::SetGCThreshold(size_t bytes)
+{
+    heap.SetThreshold(bytes);
+}
+
+void VM::SetGCGrowth(double factor)
+{
+    if (factor < 1)
+        RuntimeError("The heap's growth factor must be at least 1");
+    heap.SetGrowth(factor);
+}
+
+void VM::SetFlushPolicy(const std::string &policy)
+{
+    if (policy == "line")
+        out->SetPolicy(FlushPolicy::LINE);
+    else if (policy == "size")
+        out->SetPolicy(FlushPolicy::SIZE);
+    else if (policy == "exit")
+        out->SetPolicy(FlushPolicy::EXIT);
+    else
+        RuntimeError("Unknown flush policy '" + policy + "', expected line, size or exit");
+}
+
+char *VM::NewString(int capacity)
+{
+    CollectIfDue(sizeof(StringBuffer) + capacity);
+    char *chars = heap.Allocate(capacity, 0, sizeof(StringBuffer));
+    *BufferOf(chars) = {capacity, 0};
+    return chars;
+}
+
+char *VM::NewArray(int length, oprand_t element_size, bool holds_refs)
+{
+    size_t size = static_cast<size_t>(length) * element_size;
+    CollectIfDue(sizeof(ArrayHeader) + size);
+
+    char *elements = heap.Allocate(size, holds_refs ? element_size : 0, sizeof(ArrayHeader), ARRAY_ALIGN);
+    ArrayHeaderOf(elements)->length = length;
+    std::memset(elements, 0, size);
+    return elements;
+}
+
 void VM::PrintCallStack()
 {
     for (auto &cf : cs)
-        std::cout << "(" << cf.ret_index << ", " << cf.ret_function << ", " << cf.val_stack_min << ")" << std::endl;
+        std::cout << "(" << cf.ret_index << ", " << cf.function << ", " << cf.val_stack_min << ")" << std::endl;
 }
 
 void VM::RuntimeError(const std::string &msg)
 {
-    std::cerr << "[RUNTIME ERROR] " << msg << std::endl;
-    exit(4);
+    DumpTrace();
+    Abort(msg);
 }
 
-void VM::Jump(size_t jump)
+void VM::Abort(const std::string &msg)
 {
-    ip += jump;
+    // so that the error comes after everything printed before it
+    StdOut().Flush();
+    std::cerr << "[RUNTIME ERROR] " << msg << std::endl;
+    exit(4);
 }
 
-void VM::ExecuteProgram()
+void VM::Throw(oprand_t thrown)
 {
-    if (cur_func == UINT8_MAX)
-        return;
+    // the frames are searched before any are dropped, so an uncaught
+    // throw is reported with the call stack it happened in
+    const CallFrame *frames = cs.begin();
+    size_t depth = cs.Size();
+    size_t at = ip - 1;
+    const ThrowInfo *handler = nullptr;
+
     while (true)
     {
-        while (ip < functions[cur_func].routines[cur_routine].size())
+        for (const ThrowInfo &ti : program->exception_tables[frames[depth - 1].function])
         {
-            ExecuteInstruction();
-            Jump(1);
+            if (at >= ti.begin && at < ti.end && ti.Catches(thrown))
+            {
+                handler = &ti;
+                break;
+            }
         }
 
-        if (!cs.empty())
-        {
-
-            CallFrame return_cf = *cur_cf;
-            cs.pop_back();
-            cur_cf = &cs.back();
-            ip = return_cf.ret_index;
+        if (handler != nullptr)
+            break;
+        if (depth == 1)
+            RuntimeError("Uncaught exception");
 
-            if (cur_func != 0)
-                ip++;
+        // carries on from the call in the frame beneath
+        at = frames[depth - 1].ret_index - 1;
+        depth--;
+    }
 
-            cur_func = return_cf.ret_function;
-            cur_routine = 0;
-            ip = 0;
-            size_t stack_diff = stack.GetSize() - return_cf.val_stack_min;
+    char *value = stack.GetTop() - handler->var_size;
+    while (cs.Size() > depth)
+        cur_cf = cs.Pop();
 
-            // cleaning up the function's constants
-            stack.ReduceSize(stack_diff);
-        }
-        else
-            return;
-    }
+    cur_func = cur_cf->function;
+    stack.SetFrame(cur_cf->val_stack_min);
+    char *var = stack.GetFrame() + handler->var_loc;
+    std::memmove(var, value, handler->var_size);
+    stack.SetTop(var + handler->var_size);
+    ip = handler->index;
 }
 
+#ifdef VM_PROFILE_OPCODES
+#define PROFILE_OPCODE(c) RecordOpcode(c)
+#else
+#define PROFILE_OPCODE(c)
+#endif
+
+#ifdef VM_TRACE
+#define TRACE_OPCODE(c) tracer.Record(static_cast<oprand_t>(cur_func), static_cast<oprand_t>(ip - 1), stack.GetSize(), c)
+#else
+#define TRACE_OPCODE(c)
+#endif
+
+// With GCC/Clang the interpreter is direct-threaded: each handler ends in
+// its own indirect jump through a table of label addresses, so branch
+// prediction is per opcode rather than through a single shared switch.
+// Define VM_NO_COMPUTED_GOTO (or use another compiler) to get the
+// portable switch loop instead.
+#if defined(__GNUC__) && !defined(VM_NO_COMPUTED_GOTO)
+#define VM_COMPUTED_GOTO
+#endif
+
+#ifdef VM_COMPUTED_GOTO
+// labels as values are a GNU extension
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#define CASE(name) L_##name:
+#define DISPATCH()                                        \
+    do                                                    \
+    {                                                     \
+        o = code[ip++];                                   \
+        PROFILE_OPCODE(o.code);                           \
+        TRACE_OPCODE(o.code);                             \
+        goto *dispatch_table[static_cast<op_t>(o.code)]; \
+    } while (false)
+#define DISPATCH_LOOP_BEGIN DISPATCH();
+#define DISPATCH_LOOP_END
+#else
+#define CASE(name) case Opcode::name:
+#define DISPATCH() continue
+#define DISPATCH_LOOP_BEGIN     \
+    while (true)                \
+    {                           \
+        o = code[ip++];         \
+        PROFILE_OPCODE(o.code); \
+        TRACE_OPCODE(o.code);   \
+        switch (o.code)         \
+        {
+#define DISPATCH_LOOP_END \
+    }                     \
+    }
+#endif
+
+// caches the current function's code so that handlers index a
+// flat array rather than re-fetching through the frame every op.
+// Every linked function ends in a jump or return, so the dispatch
+// does not need to bounds check ip
+#define LOAD_CODE() code = cur_cf->code
+
+// hands over to the function's machine code once it is hot, which runs
+// until it reaches an instruction it leaves to the interpreter
+#define JIT_TICK()                                                                \
+    do                                                                            \
+    {                                                                             \
+        if (jit != nullptr)                                                       \
+        {                                                                         \
+            const CompiledFunction *cf = jit->Tick(cur_func, program->functions[cur_func]); \
+            if (cf != nullptr)                                                    \
+                ip = jit->Run(*cf, stack, ip);                                    \
+        }                                                                         \
+    } while (false)
+
 #define ERROR_OUT()                             \
     std::cerr << "Not implmented" << std::endl; \
     exit(3)
 
-void VM::ExecuteInstruction()
+void VM::ExecuteProgram()
 {
-    Op o = functions[cur_func].routines[cur_routine][ip];
-    switch (o.code)
-    {
-    case Opcode::POP:
+    if (cur_func == MAX_OPRAND)
+        return;
+
+    // frames cache pointers into the code, so the first is only
+    // pushed once nothing will rewrite it
+    cur_cf = cs.Push(CallFrame(0, 0, 0, program->functions[0]));
+    Run();
+}
+
+void VM::Initialise()
+{
+    if (cur_func == MAX_OPRAND)
+        return;
+
+    // function 0 as it is, apart from returning where it would
+    // call Main
+    std::vector<Op> init = program->functions[0].code;
+    init[program->MainCall()] = Op(Opcode::RETURN_VOID, 0);
+
+    cur_cf = cs.Push(CallFrame(0, 0, 0, program->functions[0]));
+    cur_cf->code = init.data();
+    Run();
+
+    ip = program->MainCall();
+}
+
+void VM::Run()
+{
+#ifdef VM_COMPUTED_GOTO
+    static void *dispatch_table[] = {
+#define x(name) &&L_##name,
+        OPCODES(x)
+#undef x
+    };
+    static_assert(sizeof(dispatch_table) / sizeof(dispatch_table[0]) == NUM_OPCODES);
+#endif
+
+    const Op *code;
+    Op o(Opcode::NONE, 0);
+
+    LOAD_CODE();
+    DISPATCH_LOOP_BEGIN
+    CASE(POP)
     {
         stack.PopBytes(o.op);
-        break;
+        DISPATCH();
     }
-    case Opcode::LOAD_INT:
+    CASE(LOAD_INT)
     {
-        stack.PushInt(functions[cur_func].ints[o.op]);
-        break;
+        stack.PushInt(cur_cf->ints[o.op]);
+        DISPATCH();
     }
-    case Opcode::LOAD_DOUBLE:
+    CASE(LOAD_DOUBLE)
     {
-        stack.PushDouble(functions[cur_func].doubles[o.op]);
-        break;
+        stack.PushDouble(cur_cf->doubles[o.op]);
+        DISPATCH();
     }
-    case Opcode::LOAD_BOOL:
+    CASE(LOAD_BOOL)
     {
-        stack.PushBool(functions[cur_func].bools[o.op]);
-        break;
+        stack.PushBool(program->functions[cur_func].bools[o.op]);
+        DISPATCH();
     }
-    case Opcode::LOAD_STRING:
+    CASE(LOAD_STRING)
     {
-        stack.PushString(functions[cur_func].strings[o.op]);
-        break;
+        const StringConstant &str = program->strings.Get(cur_func, o.op);
+        stack.PushString(str.ptr, str.len);
+        DISPATCH();
     }
-    case Opcode::LOAD_CHAR:
+    CASE(LOAD_CHAR)
     {
-        stack.PushChar(functions[cur_func].chars[o.op]);
-        break;
+        stack.PushChar(program->functions[cur_func].chars[o.op]);
+        DISPATCH();
     }
-    case Opcode::INT_ASSIGN:
+    CASE(INT_ASSIGN)
     {
         stack.SetInt(o.op, stack.PeekInt());
-        break;
+        DISPATCH();
     }
-    case Opcode::DOUBLE_ASSIGN:
+    CASE(DOUBLE_ASSIGN)
     {
         stack.SetDouble(o.op, stack.PeekDouble());
-        break;
+        DISPATCH();
     }
-    case Opcode::BOOL_ASSIGN:
+    CASE(BOOL_ASSIGN)
     {
         stack.SetBool(o.op, stack.PeekBool());
-        break;
+        DISPATCH();
     }
-    case Opcode::STRING_ASSIGN:
+    CASE(STRING_ASSIGN)
     {
-        int len = stack.PeekInt();
-        char *str = stack.PeekPtr();
-        stack.SetString(o.op, str, len);
-        break;
+        stack.SetString(o.op, stack.PeekString());
+        DISPATCH();
     }
-    case Opcode::CHAR_ASSIGN:
+    CASE(CHAR_ASSIGN)
     {
         stack.SetChar(o.op, stack.PeekChar());
-        break;
+        DISPATCH();
     }
-    case Opcode::ARRAY_ASSIGN:
+    CASE(ARRAY_ASSIGN)
     {
-        ERROR_OUT();
-        break;
+        stack.SetArray(o.op, stack.PeekArray());
+        DISPATCH();
     }
-    case Opcode::STRUCT_ASSIGN:
+    CASE(STRUCT_ASSIGN)
     {
         ERROR_OUT();
-        break;
+        DISPATCH();
     }
-    case Opcode::PUSH:
+    CASE(PUSH)
     {
         stack.PushOprandT(o.op);
-        break;
+        DISPATCH();
     }
-    case Opcode::PUSH_SP_OFFSET:
+    CASE(PUSH_SP_OFFSET)
     {
         stack.PushPtr(stack.GetTop() + o.op);
-        break;
+        DISPATCH();
     }
-    case Opcode::GET_INT:
+    CASE(GET_INT)
     {
         stack.PushInt(stack.GetInt(o.op));
-        break;
+        DISPATCH();
     }
-    case Opcode::GET_DOUBLE:
+    CASE(GET_DOUBLE)
     {
         stack.PushDouble(stack.GetDouble(o.op));
-        break;
+        DISPATCH();
     }
-    case Opcode::GET_BOOL:
+    CASE(GET_BOOL)
     {
         stack.PushBool(stack.GetBool(o.op));
-        break;
+        DISPATCH();
     }
-    case Opcode::GET_STRING:
+    CASE(GET_STRING)
     {
-        char *str_len = stack.GetString(o.op);
-        int len = *(int *)(str_len + PTR_SIZE);
-        stack.PushString(str_len, len);
-        break;
+        stack.PushString(stack.GetString(o.op));
+        DISPATCH();
     }
-    case Opcode::GET_CHAR:
+    CASE(GET_CHAR)
     {
         stack.PushChar(stack.GetChar(o.op));
-        break;
+        DISPATCH();
     }
-    case Opcode::GET_ARRAY:
+    CASE(GET_ARRAY)
     {
-        ERROR_OUT();
-        break;
+        stack.PushArray(stack.GetArray(o.op));
+        DISPATCH();
     }
-    case Opcode::GET_STRUCT:
+    CASE(GET_STRUCT)
     {
         ERROR_OUT();
+        DISPATCH();
+    }
+    // ARRAYS: the array, the index and then the element size are on
+    // the stack. The _UNCHECKED forms leave out the bounds check
+    CASE(ARR_INDEX)
+    {
+        oprand_t size = stack.PopOprandT();
+        int index = stack.PopInt();
+        char *arr = stack.PopArray();
+        CheckArrayIndex(arr, index);
+        stack.PushBytes(arr + static_cast<size_t>(index) * size, size);
+        DISPATCH();
+    }
+    CASE(ARR_INDEX_UNCHECKED)
+    {
+        oprand_t size = stack.PopOprandT();
+        int index = stack.PopInt();
+        char *arr = stack.PopArray();
+        stack.PushBytes(arr + static_cast<size_t>(index) * size, size);
+        DISPATCH();
+    }
+    // the value assigned is beneath the array, and is left on the stack
+    CASE(ARR_SET)
+    {
+        oprand_t size = stack.PopOprandT();
+        int index = stack.PopInt();
+        char *arr = stack.PopArray();
+        CheckArrayIndex(arr, index);
+        std::memcpy(arr + static_cast<size_t>(index) * size, stack.GetTop() - size, size);
+        DISPATCH();
+    }
+    CASE(ARR_SET_UNCHECKED)
+    {
+        oprand_t size = stack.PopOprandT();
+        int index = stack.PopInt();
+        char *arr = stack.PopArray();
+        std::memcpy(arr + static_cast<size_t>(index) * size, stack.GetTop() - size, size);
+        DISPATCH();
+    }
+    // the length then the element size are on the stack, and o.op
+    // is set if the elements can refer to other objects
+    CASE(ARR_ALLOC)
+    {
+        oprand_t size = stack.PopOprandT();
+        int length = stack.PopInt();
+        if (length < 0)
+            RuntimeError("Cannot allocate an array of length " + std::to_string(length));
+        stack.PushArray(NewArray(length, size, o.op != 0));
+        DISPATCH();
+    }
+    CASE(STRING_INDEX)
+    {
+        int index = stack.PopInt();
+        char *str = stack.PopString();
+        CheckIndex(index, StringLength(str));
+        stack.PushChar(StringChars(str)[index]);
+        DISPATCH();
+    }
+    // sets a char of the string variable at o.op to the one on the
+    // stack, beneath the index, and leaves the char on the stack
+    CASE(STRING_SET)
+    {
+        int index = stack.PopInt();
+        char *str = stack.GetString(o.op);
+        int len = StringLength(str);
+        CheckIndex(index, len);
+
+        // strings share their chars, so one that is not inline is
+        // copied before it is changed
+        char *chars = str;
+        if (!IsInlineString(str))
+        {
+            chars = NewString(len);
+            std::memcpy(chars, StringChars(str), len);
+            BufferOf(chars)->used = len;
+            WriteString(str, chars, len);
+        }
+        chars[index] = stack.PeekChar();
+        DISPATCH();
     }
-    case Opcode::ARR_INDEX:
-    {
-        break;
-    }
-    case Opcode::ARR_SET:
-    {
-        break;
-    }
-    case Opcode::ARR_ALLOC:
-    {
-        break;
-    }
-    case Opcode::STRING_INDEX:
-    {
-        break;
-    }
-    case Opcode::STRING_SET:
+    CASE(SET_IP)
     {
-        break;
+        ip = o.op;
+        DISPATCH();
     }
-    case Opcode::SET_IP:
+    CASE(GOTO_LABEL)
     {
+        // backward branches close loops
+        bool backward = o.op < ip;
         ip = o.op;
-        break;
+        if (backward)
+            JIT_TICK();
+        DISPATCH();
     }
-    case Opcode::GOTO_LABEL:
+    CASE(GOTO_LABEL_IF_FALSE)
     {
-        cur_routine = o.op;
-        ip = -1;
-        break;
+        if (!stack.PopBool())
+            ip = o.op;
+        DISPATCH();
     }
-    case Opcode::GOTO_LABEL_IF_FALSE:
+    CASE(CALL_F)
     {
-        break;
+        if (cs.IsFull())
+            RuntimeError("CallStack overflow. Used: " + std::to_string(cs.Size()) + " call-frames");
+
+        // the arguments become the start of the callee's frame
+        const Function &callee = program->functions[o.op];
+        oprand_t frame = stack.GetSize() - callee.arg_size;
+        cur_cf = cs.Push(CallFrame(static_cast<oprand_t>(ip), o.op, frame, callee));
+        stack.Reserve(callee.max_stack);
+        stack.SetFrame(frame);
+
+        cur_func = o.op;
+        ip = 0;
+        JIT_TICK();
+        LOAD_CODE();
+        DISPATCH();
     }
-    case Opcode::CALL_F:
+    CASE(TAIL_CALL)
     {
-        cs.push_back({ip, cur_func, stack.GetSize() - functions[o.op].arity});
-        cur_cf = &cs.back();
-
-        if (cs.size() > STACK_MAX)
-            RuntimeError("CallStack overflow. Used: " + std::to_string(cs.size()) + " call-frames");
+        // the callee takes over the current frame and so returns
+        // straight to this function's caller
+        const Function &callee = program->functions[o.op];
+        stack.DropFrame(cur_cf->val_stack_min, callee.arg_size);
+        stack.Reserve(callee.max_stack);
+        *cur_cf = CallFrame(cur_cf->ret_index, o.op, cur_cf->val_stack_min, callee);
 
         cur_func = o.op;
-        ip = -1;
-        break;
+        ip = 0;
+        JIT_TICK();
+        LOAD_CODE();
+        DISPATCH();
     }
-    case Opcode::CALL_LIBRARY_FUNC:
+    CASE(CALL_LIBRARY_FUNC)
     {
-        break;
+        const LibraryCall &lc = program->lib_calls[o.op];
+        char *args = stack.GetTop() - lc.arg_size;
+        lc.func(args, args);
+        stack.ReplaceTop(lc.arg_size, lc.ret_size);
+        DISPATCH();
     }
-    case Opcode::RETURN:
+    CASE(CALL_AOT)
     {
-        CallFrame return_cf = *cur_cf;
-        cs.pop_back();
-        cur_cf = &cs.back();
-
-        ip = return_cf.ret_index;
-        cur_func = return_cf.ret_function;
-
-        size_t stack_diff = stack.GetSize() - return_cf.val_stack_min;
-        // Object *retVal = stack.back;
-
-        // cleaning up the function's constants
-        stack.PopBytes(stack_diff);
-        // stack.push_back(retVal);
-        break;
+        // the arguments are replaced with the return value
+        oprand_t arg_size = program->functions[o.op].arg_size;
+        program->aot_module->functions[o.op](stack.GetTop() - arg_size);
+        stack.ReplaceTop(arg_size, program->aot_module->ret_sizes[o.op]);
+        DISPATCH();
     }
-    case Opcode::RETURN_VOID:
+    CASE(RETURN)
     {
-        CallFrame return_cf = *cur_cf;
-        cs.pop_back();
-        cur_cf = &cs.back();
-
-        ip = return_cf.ret_index;
-        cur_func = return_cf.ret_function;
+        oprand_t ret_index = cur_cf->ret_index;
+        oprand_t base = cur_cf->val_stack_min;
+        cur_cf = cs.Pop();
+        if (cur_cf == nullptr)
+            return;
 
-        size_t stack_diff = stack.GetSize() - return_cf.val_stack_min;
+        ip = ret_index;
+        cur_func = cur_cf->function;
+        LOAD_CODE();
 
-        // cleaning up the function's constants
-        stack.PopBytes(stack_diff);
-        break;
+        // the oprand is the size of the return value,
+        // which is left in place of the frame
+        stack.DropFrame(base, o.op);
+        stack.SetFrame(cur_cf->val_stack_min);
+        DISPATCH();
     }
-    case Opcode::PUSH_THROW_INFO:
+    CASE(RETURN_VOID)
     {
-        throw_stack.push(throw_infos[o.op]);
-        break;
+        oprand_t ret_index = cur_cf->ret_index;
+        oprand_t base = cur_cf->val_stack_min;
+        cur_cf = cs.Pop();
+        if (cur_cf == nullptr)
+            return;
+
+        ip = ret_index;
+        cur_func = cur_cf->function;
+        LOAD_CODE();
+
+        stack.DropFrame(base, 0);
+        stack.SetFrame(cur_cf->val_stack_min);
+        DISPATCH();
     }
-    case Opcode::THROW:
+    CASE(THROW)
     {
-        break;
+        Throw(o.op);
+        LOAD_CODE();
+        DISPATCH();
     }
-    case Opcode::NATIVE_CALL:
+    CASE(NATIVE_CALL)
     {
-        oprand_t num_bytes = stack.PopOprandT();
-        ReturnValue ret = natives[o.op](stack.GetTop() - num_bytes);
-        if (ret != NULL_RETURN)
-            stack.PushReturnValue(ret);
-        break;
+        // the arguments are replaced with the return value
+        const NativeFunction &nf = natives[o.op];
+        nf.call(stack.GetTop() - nf.arg_size);
+        stack.ReplaceTop(nf.arg_size, nf.ret_size);
+        DISPATCH();
     }
-    case Opcode::STRUCT_MEMBER:
+    CASE(STRUCT_MEMBER)
     {
-        break;
+        DISPATCH();
     }
-    case Opcode::STRUCT_D:
+    CASE(STRUCT_D)
     {
-        break;
+        DISPATCH();
     }
-    case Opcode::STRUCT_MEMBER_SET:
+    CASE(STRUCT_MEMBER_SET)
     {
-        break;
+        DISPATCH();
     }
-    case Opcode::CAST:
+    CASE(CAST)
     {
-        break;
+        DISPATCH();
     }
     // ADDITIONS: adds the last 2 things on the stack
-    case Opcode::I_ADD:
+    CASE(I_ADD)
     {
         int r = stack.PopInt();
         int l = stack.PopInt();
         stack.PushInt(l + r);
-        std::cout << l + r << std::endl;
-        break;
+        DISPATCH();
     }
-    case Opcode::DI_ADD:
+    CASE(DI_ADD)
     {
         int r = stack.PopInt();
         double l = stack.PopDouble();
         stack.PushDouble(l + r);
-        break;
+        DISPATCH();
     }
-    case Opcode::ID_ADD:
+    CASE(ID_ADD)
     {
         double r = stack.PopDouble();
         int l = stack.PopInt();
         stack.PushDouble(l + r);
-        break;
+        DISPATCH();
     }
-    case Opcode::D_ADD:
+    CASE(D_ADD)
     {
         double r = stack.PopDouble();
         double l = stack.PopDouble();
         stack.PushDouble(l + r);
-        break;
+        DISPATCH();
     }
-    case Opcode::S_ADD:
+    CASE(S_ADD)
     {
-        char *l = stack.PopString();
-        char *r = stack.PopString();
+        // the oprands are left on the stack while the result is
+        // built, so that they are roots if it allocates
+        char *r = stack.GetTop() - STRING_SIZE;
+        char *l = r - STRING_SIZE;
 
-        int l_len = *(int *)l;
-        int r_len = *(int *)r;
+        int l_len = StringLength(l);
+        int r_len = StringLength(r);
+        int new_len = l_len + r_len;
 
-        char *l_ptr = l + INT_SIZE;
-        char *r_ptr = r + INT_SIZE;
+        // a result short enough to inline is built on the C++ stack,
+        // as it overwrites the oprands when pushed
+        char buf[INLINE_STRING_CAPACITY];
+        if (new_len <= INLINE_STRING_CAPACITY)
+        {
+            std::memcpy(buf, StringChars(l), l_len);
+            std::memcpy(buf + l_len, StringChars(r), r_len);
+            stack.PopBytes(2 * STRING_SIZE);
+            stack.PushString(buf, new_len);
+            DISPATCH();
+        }
 
-        int new_len = l_len + r_len;
-        char *new_ptr = new char[new_len];
+        // r is appended in place if l is the whole of a buffer in use
+        // and there is room, otherwise both are copied to a new buffer
+        // with as much room again to grow into
+        if (l_len > INLINE_STRING_CAPACITY && !program->strings.Contains(*(char **)l))
+        {
+            char *l_ptr = *(char **)l;
+            StringBuffer *b = BufferOf(l_ptr);
+            if (b->used == l_len && b->capacity >= new_len)
+            {
+                std::memcpy(l_ptr + l_len, StringChars(r), r_len);
+                b->used = new_len;
+                stack.PopBytes(2 * STRING_SIZE);
+                stack.PushString(l_ptr, new_len);
+                DISPATCH();
+            }
+        }
 
-        std::memcpy(new_ptr, l_ptr, l_len);
-        char *next = new_ptr + l_len;
-        std::memcpy(next, r_ptr, r_len);
+        char *new_ptr = NewString(new_len * 2);
+        std::memcpy(new_ptr, StringChars(l), l_len);
+        std::memcpy(new_ptr + l_len, StringChars(r), r_len);
+        BufferOf(new_ptr)->used = new_len;
 
-        stack.PushInt(new_len);
-        stack.PushPtr(new_ptr);
-        break;
+        stack.PopBytes(2 * STRING_SIZE);
+        stack.PushString(new_ptr, new_len);
+        DISPATCH();
     }
     // SUBTRACTIONS: subtracts the last 2 things on the stack
     // if o.op is 1 then is a unary negation (only the case
     // for I_SUB and D_SUB obviously)
-    case Opcode::I_SUB:
+    CASE(I_SUB)
     {
         int r = stack.PopInt();
-        if (o.op != 0)
+        if (o.op == 0)
         {
             int l = stack.PopInt();
             stack.PushInt(l - r);
         }
         else
             stack.PushInt(-r);
-        break;
+        DISPATCH();
     }
-    case Opcode::DI_SUB:
+    CASE(DI_SUB)
     {
         int r = stack.PopInt();
         double l = stack.PopDouble();
         stack.PushDouble(l - r);
-        break;
+        DISPATCH();
     }
-    case Opcode::ID_SUB:
+    CASE(ID_SUB)
     {
         double r = stack.PopDouble();
         int l = stack.PopInt();
         stack.PushDouble(l - r);
-        break;
+        DISPATCH();
     }
-    case Opcode::D_SUB:
+    CASE(D_SUB)
     {
         double r = stack.PopDouble();
-        if (o.op != 0)
+        if (o.op == 0)
         {
             double l = stack.PopDouble();
             stack.PushDouble(l - r);
         }
         else
             stack.PushDouble(-r);
-        break;
+        DISPATCH();
     }
     // multiplies the last 2 things on the stack
-    case Opcode::I_MUL:
+    CASE(I_MUL)
     {
         int r = stack.PopInt();
         int l = stack.PopInt();
-        stack.PushDouble(l * r);
-        break;
+        stack.PushInt(l * r);
+        DISPATCH();
     }
-    case Opcode::DI_MUL:
+    CASE(DI_MUL)
     {
         int r = stack.PopInt();
         double l = stack.PopDouble();
         stack.PushDouble(l * r);
-        break;
+        DISPATCH();
     }
-    case Opcode::ID_MUL:
+    CASE(ID_MUL)
     {
         double r = stack.PopDouble();
         int l = stack.PopInt();
         stack.PushDouble(l * r);
-        break;
+        DISPATCH();
     }
-    case Opcode::D_MUL:
+    CASE(D_MUL)
     {
         double r = stack.PopDouble();
         double l = stack.PopDouble();
         stack.PushDouble(l * r);
-        break;
+        DISPATCH();
     }
     // divides the last 2 things on the stack
-    case Opcode::I_DIV:
+    CASE(I_DIV)
     {
         int r = stack.PopInt();
         int l = stack.PopInt();
         stack.PushInt(l / r);
-        break;
+        DISPATCH();
     }
-    case Opcode::DI_DIV:
+    CASE(DI_DIV)
     {
         int r = stack.PopInt();
         double l = stack.PopDouble();
         stack.PushDouble(l / r);
-        break;
+        DISPATCH();
     }
-    case Opcode::ID_DIV:
+    CASE(ID_DIV)
     {
         double r = stack.PopDouble();
         int l = stack.PopInt();
         stack.PushDouble(l / r);
-        break;
+        DISPATCH();
     }
-    case Opcode::D_DIV:
+    CASE(D_DIV)
     {
         double r = stack.PopDouble();
         double l = stack.PopDouble();
         stack.PushDouble(l / r);
-        break;
+        DISPATCH();
     }
     // does a greater than comparison on the last 2 things on the stack
-    case Opcode::I_GT:
+    CASE(I_GT)
     {
         int r = stack.PopInt();
         int l = stack.PopInt();
         stack.PushBool(l > r);
-        break;
+        DISPATCH();
     }
-    case Opcode::DI_GT:
+    CASE(DI_GT)
     {
         int r = stack.PopInt();
         double l = stack.PopDouble();
         stack.PushBool(l > r);
-        break;
+        DISPATCH();
     }
-    case Opcode::ID_GT:
+    CASE(ID_GT)
     {
         double r = stack.PopDouble();
         int l = stack.PopInt();
         stack.PushBool(l > r);
-        break;
+        DISPATCH();
     }
-    case Opcode::D_GT:
+    CASE(D_GT)
     {
         double r = stack.PopDouble();
         double l = stack.PopDouble();
         stack.PushBool(l > r);
-        break;
+        DISPATCH();
     }
     // does a less than comparison on the last 2 things on the stack
-    case Opcode::I_LT:
+    CASE(I_LT)
     {
         int r = stack.PopInt();
         int l = stack.PopInt();
         stack.PushBool(l < r);
-        break;
+        DISPATCH();
     }
-    case Opcode::DI_LT:
+    CASE(DI_LT)
     {
         int r = stack.PopInt();
         double l = stack.PopDouble();
         stack.PushBool(l < r);
-        break;
+        DISPATCH();
     }
-    case Opcode::ID_LT:
+    CASE(ID_LT)
     {
         double r = stack.PopDouble();
         int l = stack.PopInt();
         stack.PushBool(l < r);
-        break;
+        DISPATCH();
     }
-    case Opcode::D_LT:
+    CASE(D_LT)
     {
         double r = stack.PopDouble();
         double l = stack.PopDouble();
         stack.PushBool(l < r);
-        break;
+        DISPATCH();
     }
     // does a greater than or equal comparison on the last 2 things on the stack
-    case Opcode::I_GEQ:
+    CASE(I_GEQ)
     {
         int r = stack.PopInt();
         int l = stack.PopInt();
         stack.PushBool(l >= r);
-        break;
+        DISPATCH();
     }
-    case Opcode::DI_GEQ:
+    CASE(DI_GEQ)
     {
         int r = stack.PopInt();
         double l = stack.PopDouble();
         stack.PushBool(l >= r);
-        break;
+        DISPATCH();
     }
-    case Opcode::ID_GEQ:
+    CASE(ID_GEQ)
     {
         double r = stack.PopDouble();
         int l = stack.PopInt();
         stack.PushBool(l >= r);
-        break;
+        DISPATCH();
     }
-    case Opcode::D_GEQ:
+    CASE(D_GEQ)
     {
         double r = stack.PopDouble();
         double l = stack.PopDouble();
         stack.PushBool(l >= r);
-        break;
+        DISPATCH();
     }
     // does a less than or equal comparison on the last 2 things on the stack
-    case Opcode::I_LEQ:
+    CASE(I_LEQ)
     {
         int r = stack.PopInt();
         int l = stack.PopInt();
         stack.PushBool(l <= r);
-        break;
+        DISPATCH();
     }
-    case Opcode::DI_LEQ:
+    CASE(DI_LEQ)
     {
         int r = stack.PopInt();
         double l = stack.PopDouble();
         stack.PushBool(l <= r);
-        break;
+        DISPATCH();
     }
-    case Opcode::ID_LEQ:
+    CASE(ID_LEQ)
     {
         double r = stack.PopDouble();
         int l = stack.PopInt();
         stack.PushBool(l <= r);
-        break;
+        DISPATCH();
     }
-    case Opcode::D_LEQ:
+    CASE(D_LEQ)
     {
         double r = stack.PopDouble();
         double l = stack.PopDouble();
         stack.PushBool(l <= r);
-        break;
+        DISPATCH();
     }
-    case Opcode::N_EQ_EQ:
+    CASE(N_EQ_EQ)
     {
         ERROR_OUT();
-        break;
+        DISPATCH();
     }
     // does an equality check on the last 2 things on the stack
-    case Opcode::I_EQ_EQ:
+    CASE(I_EQ_EQ)
     {
         int r = stack.PopInt();
         int l = stack.PopInt();
         stack.PushBool(l == r);
-        break;
+        DISPATCH();
     }
-    case Opcode::DI_EQ_EQ:
+    CASE(DI_EQ_EQ)
     {
         int r = stack.PopInt();
         double l = stack.PopDouble();
         stack.PushBool(l == r);
-        break;
+        DISPATCH();
     }
-    case Opcode::ID_EQ_EQ:
+    CASE(ID_EQ_EQ)
     {
         double r = stack.PopDouble();
         int l = stack.PopDouble();
         stack.PushBool(l == r);
-        break;
+        DISPATCH();
     }
-    case Opcode::D_EQ_EQ:
+    CASE(D_EQ_EQ)
     {
         double r = stack.PopDouble();
         double l = stack.PopDouble();
         stack.PushBool(l == r);
-        break;
+        DISPATCH();
     }
-    case Opcode::B_EQ_EQ:
+    CASE(B_EQ_EQ)
     {
         bool r = stack.PopBool();
         bool l = stack.PopBool();
         stack.PushBool(l == r);
-        break;
+        DISPATCH();
     }
-    case Opcode::N_BANG_EQ:
+    CASE(N_BANG_EQ)
     {
         ERROR_OUT();
-        break;
+        DISPATCH();
     }
     // does an inequality check on the last 2 things on the stack
-    case Opcode::I_BANG_EQ:
+    CASE(I_BANG_EQ)
     {
         int r = stack.PopInt();
         int l = stack.PopInt();
         stack.PushBool(l != r);
-        break;
+        DISPATCH();
     }
-    case Opcode::DI_BANG_EQ:
+    CASE(DI_BANG_EQ)
     {
         int r = stack.PopInt();
         double l = stack.PopDouble();
         stack.PushBool(l != r);
-        break;
+        DISPATCH();
     }
-    case Opcode::ID_BANG_EQ:
+    CASE(ID_BANG_EQ)
     {
         double r = stack.PopDouble();
         int l = stack.PopInt();
         stack.PushBool(l != r);
-        break;
+        DISPATCH();
     }
-    case Opcode::D_BANG_EQ:
+    CASE(D_BANG_EQ)
     {
         double r = stack.PopDouble();
         double l = stack.PopDouble();
         stack.PushBool(l != r);
-        break;
+        DISPATCH();
     }
-    case Opcode::B_BANG_EQ:
+    CASE(B_BANG_EQ)
     {
         bool r = stack.PopBool();
         bool l = stack.PopBool();
         stack.PushBool(l != r);
-        break;
+        DISPATCH();
     }
-    case Opcode::B_AND_AND:
+    CASE(B_AND_AND)
     {
         bool r = stack.PopBool();
         bool l = stack.PopBool();
         stack.PushBool(l && r);
-        break;
+        DISPATCH();
     }
-    case Opcode::B_OR_OR:
+    CASE(B_OR_OR)
     {
         bool r = stack.PopBool();
         bool l = stack.PopBool();
         stack.PushBool(l || r);
-        break;
+        DISPATCH();
     }
-    case Opcode::BANG:
+    CASE(BANG)
     {
         bool r = stack.PopBool();
         stack.PushBool(!r);
-        break;
+        DISPATCH();
     }
-    // Does nothing
-    case Opcode::NONE:
+    // SUPERINSTRUCTIONS: ip points at the second op of the fused
+    // sequence, which holds the next oprand
+    CASE(GET_INT_GET_INT)
+    {
+        stack.PushInt(stack.GetInt(o.op));
+        stack.PushInt(stack.GetInt(code[ip].op));
+        ip += 1;
+        DISPATCH();
+    }
+    // GET_INT l, GET_INT r, I_ADD, INT_ASSIGN x, POP
+    CASE(INT_ADD_ASSIGN)
+    {
+        int l = stack.GetInt(o.op);
+        int r = stack.GetInt(code[ip].op);
+        stack.SetInt(code[ip + 2].op, l + r);
+        ip += 4;
+        DISPATCH();
+    }
+    // GET_INT l, LOAD_INT r, I_ADD, INT_ASSIGN x, POP
+    CASE(INT_ADD_CONST_ASSIGN)
+    {
+        int l = stack.GetInt(o.op);
+        int r = cur_cf->ints[code[ip].op];
+        stack.SetInt(code[ip + 2].op, l + r);
+        ip += 4;
+        DISPATCH();
+    }
+
+    // GET_INT l, GET_INT/LOAD_INT r, comparison, GOTO_LABEL_IF_FALSE
+#define INT_COMPARE_JUMP(name, cmp, get_r)           \
+    CASE(name)                                        \
+    {                                                 \
+        int l = stack.GetInt(o.op);                   \
+        int r = get_r;                                \
+        ip = (l cmp r) ? ip + 3 : code[ip + 2].op;    \
+        DISPATCH();                                   \
+    }
+#define LOCAL stack.GetInt(code[ip].op)
+#define CONSTANT cur_cf->ints[code[ip].op]
+    INT_COMPARE_JUMP(INT_LT_JUMP_IF_FALSE, <, LOCAL)
+    INT_COMPARE_JUMP(INT_LEQ_JUMP_IF_FALSE, <=, LOCAL)
+    INT_COMPARE_JUMP(INT_GT_JUMP_IF_FALSE, >, LOCAL)
+    INT_COMPARE_JUMP(INT_GEQ_JUMP_IF_FALSE, >=, LOCAL)
+    INT_COMPARE_JUMP(INT_EQ_EQ_JUMP_IF_FALSE, ==, LOCAL)
+    INT_COMPARE_JUMP(INT_BANG_EQ_JUMP_IF_FALSE, !=, LOCAL)
+    INT_COMPARE_JUMP(INT_LT_CONST_JUMP_IF_FALSE, <, CONSTANT)
+    INT_COMPARE_JUMP(INT_LEQ_CONST_JUMP_IF_FALSE, <=, CONSTANT)
+    INT_COMPARE_JUMP(INT_GT_CONST_JUMP_IF_FALSE, >, CONSTANT)
+    INT_COMPARE_JUMP(INT_GEQ_CONST_JUMP_IF_FALSE, >=, CONSTANT)
+    INT_COMPARE_JUMP(INT_EQ_EQ_CONST_JUMP_IF_FALSE, ==, CONSTANT)
+    INT_COMPARE_JUMP(INT_BANG_EQ_CONST_JUMP_IF_FALSE, !=, CONSTANT)
+#undef LOCAL
+#undef CONSTANT
+#undef INT_COMPARE_JUMP
+
+    // REGISTER INSTRUCTIONS: ip points at the first NONE op holding
+    // the remaining oprands, the right oprand is read first as it is
+    // the one on top if both come off the stack
+    CASE(R_I_MOV)
+    {
+        RegSetInt(o.op, RegInt(code[ip].op));
+        ip += 1;
+        DISPATCH();
+    }
+    CASE(R_D_MOV)
+    {
+        RegSetDouble(o.op, RegDouble(code[ip].op));
+        ip += 1;
+        DISPATCH();
+    }
+
+#define REG_ARITHMETIC(name, type, get, set, operation) \
+    CASE(name)                                          \
+    {                                                   \
+        type r = get(code[ip + 1].op);                  \
+        type l = get(code[ip].op);                      \
+        set(o.op, l operation r);                       \
+        ip += 2;                                        \
+        DISPATCH();                                     \
+    }
+    REG_ARITHMETIC(R_I_ADD, int, RegInt, RegSetInt, +)
+    REG_ARITHMETIC(R_I_SUB, int, RegInt, RegSetInt, -)
+    REG_ARITHMETIC(R_I_MUL, int, RegInt, RegSetInt, *)
+    REG_ARITHMETIC(R_I_DIV, int, RegInt, RegSetInt, /)
+    REG_ARITHMETIC(R_D_ADD, double, RegDouble, RegSetDouble, +)
+    REG_ARITHMETIC(R_D_SUB, double, RegDouble, RegSetDouble, -)
+    REG_ARITHMETIC(R_D_MUL, double, RegDouble, RegSetDouble, *)
+    REG_ARITHMETIC(R_D_DIV, double, RegDouble, RegSetDouble, /)
+#undef REG_ARITHMETIC
+
+#define REG_COMPARE_JUMP(name, type, get, cmp)   \
+    CASE(name)                                   \
+    {                                            \
+        type r = get(code[ip + 1].op);           \
+        type l = get(code[ip].op);               \
+        ip = (l cmp r) ? ip + 2 : o.op;          \
+        DISPATCH();                              \
+    }
+    REG_COMPARE_JUMP(R_I_LT_JUMP_IF_FALSE, int, RegInt, <)
+    REG_COMPARE_JUMP(R_I_LEQ_JUMP_IF_FALSE, int, RegInt, <=)
+    REG_COMPARE_JUMP(R_I_GT_JUMP_IF_FALSE, int, RegInt, >)
+    REG_COMPARE_JUMP(R_I_GEQ_JUMP_IF_FALSE, int, RegInt, >=)
+    REG_COMPARE_JUMP(R_I_EQ_EQ_JUMP_IF_FALSE, int, RegInt, ==)
+    REG_COMPARE_JUMP(R_I_BANG_EQ_JUMP_IF_FALSE, int, RegInt, !=)
+    REG_COMPARE_JUMP(R_D_LT_JUMP_IF_FALSE, double, RegDouble, <)
+    REG_COMPARE_JUMP(R_D_LEQ_JUMP_IF_FALSE, double, RegDouble, <=)
+    REG_COMPARE_JUMP(R_D_GT_JUMP_IF_FALSE, double, RegDouble, >)
+    REG_COMPARE_JUMP(R_D_GEQ_JUMP_IF_FALSE, double, RegDouble, >=)
+    REG_COMPARE_JUMP(R_D_EQ_EQ_JUMP_IF_FALSE, double, RegDouble, ==)
+    REG_COMPARE_JUMP(R_D_BANG_EQ_JUMP_IF_FALSE, double, RegDouble, !=)
+#undef REG_COMPARE_JUMP
+    // GLOBALS: the oprand is the global's offset in the globals
+    // segment, and an assignment leaves the value on the stack
+    CASE(INT_ASSIGN_GLOBAL)
+    {
+        globals.SetInt(o.op, stack.PeekInt());
+        DISPATCH();
+    }
+    CASE(DOUBLE_ASSIGN_GLOBAL)
+    {
+        globals.SetDouble(o.op, stack.PeekDouble());
+        DISPATCH();
+    }
+    CASE(BOOL_ASSIGN_GLOBAL)
+    {
+        globals.SetBool(o.op, stack.PeekBool());
+        DISPATCH();
+    }
+    CASE(STRING_ASSIGN_GLOBAL)
+    {
+        globals.SetString(o.op, stack.PeekString());
+        DISPATCH();
+    }
+    CASE(CHAR_ASSIGN_GLOBAL)
+    {
+        globals.SetChar(o.op, stack.PeekChar());
+        DISPATCH();
+    }
+    CASE(ARRAY_ASSIGN_GLOBAL)
+    {
+        globals.SetArray(o.op, stack.PeekArray());
+        DISPATCH();
+    }
+    CASE(STRUCT_ASSIGN_GLOBAL)
+    {
+        ERROR_OUT();
+        DISPATCH();
+    }
+    CASE(GET_INT_GLOBAL)
+    {
+        stack.PushInt(globals.GetInt(o.op));
+        DISPATCH();
+    }
+    CASE(GET_DOUBLE_GLOBAL)
+    {
+        stack.PushDouble(globals.GetDouble(o.op));
+        DISPATCH();
+    }
+    CASE(GET_BOOL_GLOBAL)
     {
-        break;
+        stack.PushBool(globals.GetBool(o.op));
+        DISPATCH();
+    }
+    CASE(GET_STRING_GLOBAL)
+    {
+        stack.PushString(globals.GetString(o.op));
+        DISPATCH();
+    }
+    CASE(GET_CHAR_GLOBAL)
+    {
+        stack.PushChar(globals.GetChar(o.op));
+        DISPATCH();
+    }
+    CASE(GET_ARRAY_GLOBAL)
+    {
+        stack.PushArray(globals.GetArray(o.op));
+        DISPATCH();
+    }
+    CASE(GET_STRUCT_GLOBAL)
+    {
+        ERROR_OUT();
+        DISPATCH();
+    }
+    CASE(PRINT)
+    {
+        switch (o.op)
+        {
+        case INT_TYPE.type:
+            out->WriteInt(stack.PopInt());
+            break;
+        case DOUBLE_TYPE.type:
+            out->WriteDouble(stack.PopDouble());
+            break;
+        case BOOL_TYPE.type:
+            out->WriteBool(stack.PopBool());
+            break;
+        case STRING_TYPE.type:
+        {
+            char *str = stack.PopString();
+            out->Write(StringChars(str), StringLength(str));
+            break;
+        }
+        case CHAR_TYPE.type:
+            out->WriteChar(stack.PopChar());
+            break;
+        }
+        out->EndLine();
+        DISPATCH();
     }
+    // Does nothing
+    CASE(NONE)
+    {
+        DISPATCH();
     }
+    DISPATCH_LOOP_END
 }
 
-VM VM::DeserialiseProgram(const std::string &f_path)
+#ifdef VM_COMPUTED_GOTO
+#pragma GCC diagnostic pop
+#endif
+
+#undef PROFILE_OPCODE
+#undef CASE
+#undef DISPATCH
+#undef DISPATCH_LOOP_BEGIN
+#undef DISPATCH_LOOP_END
+#undef LOAD_CODE
+
+std::shared_ptr<Program> VM::LoadProgram(const std::string &f_path)
 {
     std::ifstream file;
     if (!DoesFileExist(f_path))
@@ -724,6 +1431,13 @@ VM VM::DeserialiseProgram(const std::string &f_path)
     oprand_t main_index;
     file.read((char *)&main_index, sizeof(main_index));
 
+    oprand_t slot_size;
+    file.read((char *)&slot_size, sizeof(slot_size));
+    if (slot_size != SLOT_SIZE)
+        DeserialisationError("'" + f_path + "' was compiled for " + std::to_string(slot_size) +
+                             " byte stack slots, but the runtime uses " + std::to_string(SLOT_SIZE) +
+                             " - build both with the same UNIFORM_SLOTS setting");
+
     oprand_t num_functions;
     file.read((char *)&num_functions, sizeof(num_functions));
 
@@ -734,6 +1448,8 @@ VM VM::DeserialiseProgram(const std::string &f_path)
     std::unordered_map<oprand_t, std::unordered_set<oprand_t>> struct_tree;
     std::vector<LibraryFunctionDef> lib_funcs;
     std::vector<ThrowInfo> throw_infos;
+    std::vector<char> global_data;
+    GlobalRefs global_refs;
 
     while (file.peek() != EOF)
     {
@@ -780,7 +1496,9 @@ VM VM::DeserialiseProgram(const std::string &f_path)
                 delete[] c_lib_name;
 
                 size_t arity = ReadSizeT(file);
-                lib_funcs.push_back(LibraryFunctionDef(name, lib_name, arity));
+                size_t arg_size = ReadSizeT(file);
+                size_t ret_size = ReadSizeT(file);
+                lib_funcs.push_back(LibraryFunctionDef(name, lib_name, arity, arg_size, ret_size));
             }
             break;
         }
@@ -789,6 +1507,17 @@ VM VM::DeserialiseProgram(const std::string &f_path)
             throw_infos = DeserialiseThrowInfos(file);
             break;
         }
+        case GLOBALS_ID:
+        {
+            global_data = DeserialiseChars(file);
+            break;
+        }
+        case GLOBAL_REFS_ID:
+        {
+            global_refs.strings = DeserialiseOprands(file);
+            global_refs.pointers = DeserialiseOprands(file);
+            break;
+        }
         default:
         {
             DeserialisationError("Invalid section identifier " + std::to_string(id));
@@ -797,7 +1526,7 @@ VM VM::DeserialiseProgram(const std::string &f_path)
         }
     }
     file.close();
-    return VM(program, main_index, struct_tree, lib_funcs, throw_infos);
+    return std::make_shared<Program>(program, main_index, struct_tree, lib_funcs, throw_infos, global_data, global_refs);
 }
 
 bool VM::DoesFileExist(const std::string &path)
@@ -815,6 +1544,10 @@ Function VM::DeserialiseFunction(std::ifstream &file)
 {
     oprand_t arity;
     file.read((char *)&arity, sizeof(arity));
+    oprand_t arg_size;
+    file.read((char *)&arg_size, sizeof(arg_size));
+    oprand_t max_stack;
+    file.read((char *)&max_stack, sizeof(max_stack));
 
     std::vector<int> ints;
     std::vector<double> doubles;
@@ -861,7 +1594,10 @@ Function VM::DeserialiseFunction(std::ifstream &file)
         }
     }
 
-    return Function(arity, code, ints, doubles, bools, chars, strings);
+    Function f(arity, code, ints, doubles, bools, chars, strings);
+    f.arg_size = arg_size;
+    f.max_stack = max_stack;
+    return f;
 }
 
 //=================================DE-SERIALISATION=================================//
@@ -922,6 +1658,16 @@ std::vector<char> VM::DeserialiseChars(std::ifstream &file)
     return result;
 }
 
+std::vector<oprand_t> VM::DeserialiseOprands(std::ifstream &file)
+{
+    size_t num_oprands = ReadSizeT(file);
+    oprand_t *data = (oprand_t *)DeserialiseData(num_oprands, sizeof(oprand_t), file);
+
+    std::vector<oprand_t> result(data, data + num_oprands);
+    delete[] data;
+    return result;
+}
+
 std::vector<std::string> VM::DeserialiseStrings(std::ifstream &file)
 {
     size_t num_strings = ReadSizeT(file);
@@ -954,8 +1700,7 @@ std::vector<std::vector<Op>> VM::DeserialiseOps(std::ifstream &file)
             Opcode code;
             file.read((char *)&code, sizeof(code));
 
-            oprand_t oprand;
-            file.read((char *)&oprand, sizeof(oprand));
+            oprand_t oprand = ReadVarint(file);
             routine.push_back(Op(code, oprand));
         }
 
@@ -976,7 +1721,11 @@ std::vector<ThrowInfo> VM::DeserialiseThrowInfos(std::ifstream &file)
         file.read((char *)&ti.is_array, sizeof(bool));
         file.read((char *)&ti.type, sizeof(ti.type));
         file.read((char *)&ti.func, sizeof(ti.func));
+        file.read((char *)&ti.begin, sizeof(ti.begin));
+        file.read((char *)&ti.end, sizeof(ti.end));
         file.read((char *)&ti.index, sizeof(ti.index));
+        file.read((char *)&ti.var_loc, sizeof(ti.var_loc));
+        file.read((char *)&ti.var_size, sizeof(ti.var_size));
         result.push_back(ti);
     }
     return result;
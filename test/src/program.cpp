@@ -0,0 +1,379 @@
+#include "../catch.h"
+
+#include "vm.h"
+#include <cstdio>
+#include <filesystem>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// writes a .lo as the compiler would serialise it, so the
+// runtime can be tested without compiling a script
+struct LoWriter
+{
+    std::ofstream file;
+
+    LoWriter(const std::string &path, oprand_t main_index, oprand_t num_functions)
+        : file(path, std::ios::out | std::ios::trunc | std::ios::binary)
+    {
+        oprand_t slot_size = static_cast<oprand_t>(SLOT_SIZE);
+        file.write((char *)&main_index, sizeof(main_index));
+        file.write((char *)&slot_size, sizeof(slot_size));
+        file.write((char *)&num_functions, sizeof(num_functions));
+    }
+
+    void Size(size_t x) { file.write((char *)&x, sizeof(x)); }
+
+    template <typename T>
+    void Data(size_t id, const std::vector<T> &data)
+    {
+        Size(id);
+        Size(data.size());
+        file.write((const char *)data.data(), data.size() * sizeof(T));
+    }
+
+    void AddFunction(const Function &f)
+    {
+        file.write((char *)&f.arity, sizeof(f.arity));
+        file.write((char *)&f.arg_size, sizeof(f.arg_size));
+        file.write((char *)&f.max_stack, sizeof(f.max_stack));
+
+        Data(INT_ID, f.ints);
+        Data(DOUBLE_ID, f.doubles);
+        Data(BOOL_ID, std::vector<char>(f.bools.begin(), f.bools.end()));
+        Data(CHAR_ID, f.chars);
+
+        Size(STRING_ID);
+        Size(f.strings.size());
+        for (const std::string &str : f.strings)
+        {
+            Size(str.length());
+            file.write(str.data(), str.length());
+        }
+
+        Size(CODE_ID);
+        Size(f.routines.size());
+        for (const auto &routine : f.routines)
+        {
+            Size(routine.size());
+            for (const Op &o : routine)
+            {
+                op_t code = static_cast<op_t>(o.code);
+                file.write((char *)&code, sizeof(code));
+                WriteVarint(o.op, file);
+            }
+        }
+    }
+
+    void AddGlobals(const std::vector<char> &data) { Data(GLOBALS_ID, data); }
+
+    void AddGlobalRefs(const GlobalRefs &refs)
+    {
+        Size(GLOBAL_REFS_ID);
+        for (const std::vector<oprand_t> *offsets : {&refs.strings, &refs.pointers})
+        {
+            Size(offsets->size());
+            file.write((const char *)offsets->data(), offsets->size() * sizeof(oprand_t));
+        }
+    }
+
+    void AddThrowInfos(const std::vector<ThrowInfo> &infos)
+    {
+        Size(THROW_INFO_ID);
+        Size(infos.size());
+        for (const ThrowInfo &ti : infos)
+        {
+            file.write((char *)&ti.is_array, sizeof(ti.is_array));
+            file.write((char *)&ti.type, sizeof(ti.type));
+            for (oprand_t x : {ti.func, ti.begin, ti.end, ti.index, ti.var_loc, ti.var_size})
+                file.write((char *)&x, sizeof(x));
+        }
+    }
+};
+
+// a function taking no arguments, with room for 64 bytes of stack
+Function MakeFunction(const std::vector<std::vector<Op>> &routines, const std::vector<int> &ints = {},
+                      const std::vector<double> &doubles = {}, const std::vector<std::string> &strings = {})
+{
+    Function f(0, routines, ints, doubles, {}, {}, strings);
+    f.max_stack = 64;
+    return f;
+}
+
+// runs the program the VM was given, returning what it printed
+std::string RunProgram(VM &vm)
+{
+    std::FILE *captured = std::tmpfile();
+    Output out(fileno(captured));
+
+    vm.out = &out;
+    vm.ExecuteProgram();
+    out.Flush();
+
+    std::string printed;
+    std::rewind(captured);
+    for (int c; (c = std::fgetc(captured)) != EOF;)
+        printed += static_cast<char>(c);
+    std::fclose(captured);
+    return printed;
+}
+
+std::string RunProgram(const std::string &path)
+{
+    VM vm = VM::DeserialiseProgram(path);
+    return RunProgram(vm);
+}
+
+// runtime errors end the process, so the program is run in a child.
+// Returns its exit code and what it wrote to stderr
+std::pair<int, std::string> RunFailingProgram(const std::string &path)
+{
+    std::FILE *err = std::tmpfile();
+    pid_t child = fork();
+    if (child == 0)
+    {
+        dup2(fileno(err), STDERR_FILENO);
+        RunProgram(path);
+        _exit(0);
+    }
+
+    int status;
+    waitpid(child, &status, 0);
+
+    std::string written;
+    std::rewind(err);
+    for (int c; (c = std::fgetc(err)) != EOF;)
+        written += static_cast<char>(c);
+    std::fclose(err);
+    return {WIFEXITED(status) ? WEXITSTATUS(status) : -1, written};
+}
+
+TEST_CASE("Testing that a loaded program runs Main")
+{
+    std::string path = (std::filesystem::temp_directory_path() / "runs_main.lo").string();
+
+    SECTION("Main runs once the globals are initialised")
+    {
+        {
+            LoWriter lo(path, 1, 2);
+            lo.AddFunction(MakeFunction({{{Opcode::LOAD_INT, 0}, {Opcode::POP, INT_SIZE}}}, {7}));
+            lo.AddFunction(MakeFunction({{{Opcode::LOAD_INT, 0}, {Opcode::PRINT, INT_TYPE.type}}}, {42}));
+        }
+        REQUIRE(RunProgram(path) == "42\n");
+    }
+
+    SECTION("Main reads a global from the data section")
+    {
+        std::vector<char> data(INT_SIZE);
+        int x = 42;
+        std::memcpy(data.data(), &x, sizeof(x));
+        {
+            LoWriter lo(path, 1, 2);
+            lo.AddFunction(MakeFunction({{}}));
+            lo.AddFunction(MakeFunction({{{Opcode::GET_INT_GLOBAL, 0}, {Opcode::PRINT, INT_TYPE.type}}}));
+            lo.AddGlobals(data);
+        }
+        REQUIRE(RunProgram(path) == "42\n");
+    }
+
+    std::filesystem::remove(path);
+}
+
+TEST_CASE("Testing that an uninitialised reference is null")
+{
+    std::string path = (std::filesystem::temp_directory_path() / "null_reference.lo").string();
+
+    // the compiler pushes one as PUSH 0s, which have to zero the whole
+    // of it whatever the slot width, as with UNIFORM_SLOTS, and not
+    // leave what was on the stack before in its upper bytes
+    SECTION("Indexing it is an error rather than a read through garbage")
+    {
+        std::vector<Op> main = {{Opcode::LOAD_DOUBLE, 0}, {Opcode::POP, DOUBLE_SIZE}};
+        for (size_t pushed = 0; pushed < PTR_SIZE; pushed += OPRAND_SIZE)
+            main.push_back({Opcode::PUSH, 0});
+        main.insert(main.end(), {{Opcode::LOAD_INT, 0}, {Opcode::PUSH, INT_SIZE}, {Opcode::ARR_INDEX, 0}});
+        {
+            LoWriter lo(path, 1, 2);
+            lo.AddFunction(MakeFunction({{}}));
+            lo.AddFunction(MakeFunction({main}, {0}, {-1.0}));
+        }
+
+        auto [code, err] = RunFailingProgram(path);
+        REQUIRE(code == 4);
+        REQUIRE(err.find("Indexing an array that was never allocated") != std::string::npos);
+    }
+
+    std::filesystem::remove(path);
+}
+
+TEST_CASE("Testing that a throw unwinds to the catch clause")
+{
+    std::string path = (std::filesystem::temp_directory_path() / "throws.lo").string();
+    oprand_t thrown_int = ThrowInfo::ThrownType(false, INT_TYPE.type);
+    // Main keeps a local beneath the try block, which is routine 1,
+    // with the catch clause in routine 2 putting the thrown int
+    // after the local and printing both, and routine 3 after them
+    std::vector<Op> catch_clause = {{Opcode::GET_INT, INT_SIZE}, {Opcode::PRINT, INT_TYPE.type},
+                                    {Opcode::GET_INT, 0}, {Opcode::PRINT, INT_TYPE.type},
+                                    {Opcode::POP, INT_SIZE}, {Opcode::GOTO_LABEL, 3}};
+    std::vector<Op> after = {{Opcode::LOAD_INT, 2}, {Opcode::PRINT, INT_TYPE.type}};
+    ThrowInfo catches_int(false, INT_TYPE.type, 1, 1, 2, 2, INT_SIZE, INT_SIZE);
+
+    SECTION("A throw is caught in the function it happened in")
+    {
+        {
+            LoWriter lo(path, 1, 2);
+            lo.AddFunction(MakeFunction({{}}));
+            lo.AddFunction(MakeFunction({{{Opcode::LOAD_INT, 0}, {Opcode::GOTO_LABEL, 1}},
+                                         {{Opcode::LOAD_INT, 1}, {Opcode::THROW, thrown_int}, {Opcode::GOTO_LABEL, 3}},
+                                         catch_clause,
+                                         after},
+                                        {5, 7, 1}));
+            lo.AddThrowInfos({catches_int});
+        }
+        REQUIRE(RunProgram(path) == "7\n5\n1\n");
+    }
+
+    SECTION("A throw unwinds through the frames of the calls it happened in")
+    {
+        {
+            LoWriter lo(path, 1, 3);
+            lo.AddFunction(MakeFunction({{}}));
+            lo.AddFunction(MakeFunction({{{Opcode::LOAD_INT, 0}, {Opcode::GOTO_LABEL, 1}},
+                                         {{Opcode::CALL_F, 2}, {Opcode::GOTO_LABEL, 3}},
+                                         catch_clause,
+                                         after},
+                                        {5, 0, 1}));
+            // leaves a local of its own behind for the throw to drop
+            lo.AddFunction(MakeFunction({{{Opcode::LOAD_INT, 0}, {Opcode::LOAD_INT, 1}, {Opcode::THROW, thrown_int}}}, {3, 9}));
+            lo.AddThrowInfos({catches_int});
+        }
+        REQUIRE(RunProgram(path) == "9\n5\n1\n");
+    }
+
+    SECTION("A throw nothing catches is an error")
+    {
+        ThrowInfo catches_double(false, DOUBLE_TYPE.type, 1, 1, 2, 2, INT_SIZE, DOUBLE_SIZE);
+        {
+            LoWriter lo(path, 1, 2);
+            lo.AddFunction(MakeFunction({{}}));
+            lo.AddFunction(MakeFunction({{{Opcode::LOAD_INT, 0}, {Opcode::GOTO_LABEL, 1}},
+                                         {{Opcode::LOAD_INT, 1}, {Opcode::THROW, thrown_int}, {Opcode::GOTO_LABEL, 3}},
+                                         catch_clause,
+                                         after},
+                                        {5, 7, 1}));
+            lo.AddThrowInfos({catches_double});
+        }
+
+        auto [code, err] = RunFailingProgram(path);
+        REQUIRE(code == 4);
+        REQUIRE(err.find("Uncaught exception") != std::string::npos);
+    }
+
+    std::filesystem::remove(path);
+}
+
+TEST_CASE("Testing that a snapshot restores what the initialisers left")
+{
+    std::string path = (std::filesystem::temp_directory_path() / "snapshot.lo").string();
+    std::string snapshot = (std::filesystem::temp_directory_path() / "snapshot.snap").string();
+
+    // the int global at 0 is in the data section. Function 0 builds a
+    // string on the heap into the global at 8 and an array of two
+    // strings into the one at 24, the first built on the heap and the
+    // second short enough to be kept inline. Main prints all of them
+    auto write_program = [&path](int x)
+    {
+        std::vector<char> data(32);
+        std::memcpy(data.data(), &x, sizeof(x));
+
+        LoWriter lo(path, 1, 2);
+        lo.AddFunction(MakeFunction({{{Opcode::LOAD_STRING, 0}, {Opcode::LOAD_STRING, 1}, {Opcode::S_ADD, 0},
+                                      {Opcode::STRING_ASSIGN_GLOBAL, 8}, {Opcode::POP, STRING_SIZE},
+                                      {Opcode::LOAD_INT, 0}, {Opcode::PUSH, STRING_SIZE}, {Opcode::ARR_ALLOC, 1},
+                                      {Opcode::ARRAY_ASSIGN_GLOBAL, 24}, {Opcode::POP, ARRAY_SIZE},
+                                      {Opcode::LOAD_STRING, 1}, {Opcode::LOAD_STRING, 0}, {Opcode::S_ADD, 0},
+                                      {Opcode::GET_ARRAY_GLOBAL, 24}, {Opcode::LOAD_INT, 1}, {Opcode::PUSH, STRING_SIZE},
+                                      {Opcode::ARR_SET, 0}, {Opcode::POP, STRING_SIZE},
+                                      {Opcode::LOAD_STRING, 2}, {Opcode::GET_ARRAY_GLOBAL, 24}, {Opcode::LOAD_INT, 2},
+                                      {Opcode::PUSH, STRING_SIZE}, {Opcode::ARR_SET, 0}, {Opcode::POP, STRING_SIZE}}},
+                                    {2, 0, 1}, {}, {"hello there world", " and more text", "hi"}));
+        lo.AddFunction(MakeFunction({{{Opcode::GET_INT_GLOBAL, 0}, {Opcode::PRINT, INT_TYPE.type},
+                                      {Opcode::GET_STRING_GLOBAL, 8}, {Opcode::PRINT, STRING_TYPE.type},
+                                      {Opcode::GET_ARRAY_GLOBAL, 24}, {Opcode::LOAD_INT, 0}, {Opcode::PUSH, STRING_SIZE},
+                                      {Opcode::ARR_INDEX, 0}, {Opcode::PRINT, STRING_TYPE.type},
+                                      {Opcode::GET_ARRAY_GLOBAL, 24}, {Opcode::LOAD_INT, 1}, {Opcode::PUSH, STRING_SIZE},
+                                      {Opcode::ARR_INDEX, 0}, {Opcode::PRINT, STRING_TYPE.type}}},
+                                    {0, 1}));
+        lo.AddGlobals(data);
+        lo.AddGlobalRefs({{8}, {24}});
+    };
+    std::string printed = "\nhello there world and more text\n and more texthello there world\nhi\n";
+
+    // the VM the snapshot was taken in is gone by the time it is
+    // restored, so an address left unrelocated would be read after
+    // it was freed
+    auto take_snapshot = [&path, &snapshot]()
+    {
+        VM vm = VM::DeserialiseProgram(path);
+        vm.Snapshot(snapshot);
+    };
+
+    SECTION("Main prints the values relocated into the new heap")
+    {
+        write_program(7);
+        take_snapshot();
+
+        VM vm = VM::DeserialiseProgram(path);
+        REQUIRE(vm.Restore(snapshot));
+        REQUIRE(RunProgram(vm) == "7" + printed);
+    }
+
+    SECTION("A snapshot of a different program is not restored")
+    {
+        write_program(7);
+        take_snapshot();
+        write_program(8);
+
+        VM vm = VM::DeserialiseProgram(path);
+        REQUIRE_FALSE(vm.Restore(snapshot));
+        REQUIRE(RunProgram(vm) == "8" + printed);
+    }
+
+    std::filesystem::remove(path);
+    std::filesystem::remove(snapshot);
+}
+
+TEST_CASE("Testing that a tail call reuses its caller's frame")
+{
+    std::string path = (std::filesystem::temp_directory_path() / "tail_calls.lo").string();
+
+    // Count(n, acc) tail calls itself n times, deeper than the call
+    // stack goes by default, and returns acc
+    SECTION("Deep tail recursion runs in constant stack and call stack space")
+    {
+        int depth = 4 * STACK_MAX;
+        Function count = MakeFunction({{{Opcode::GET_INT, 0}, {Opcode::LOAD_INT, 0}, {Opcode::I_GT, 0},
+                                        {Opcode::GOTO_LABEL_IF_FALSE, 2}, {Opcode::GOTO_LABEL, 1}},
+                                       {{Opcode::GET_INT, 0}, {Opcode::LOAD_INT, 1}, {Opcode::I_SUB, 0},
+                                        {Opcode::GET_INT, INT_SIZE}, {Opcode::LOAD_INT, 1}, {Opcode::I_ADD, 0},
+                                        {Opcode::TAIL_CALL, 2}},
+                                       {{Opcode::GET_INT, INT_SIZE}, {Opcode::RETURN, INT_SIZE}}},
+                                      {0, 1});
+        count.arity = 2;
+        count.arg_size = 2 * INT_SIZE;
+        {
+            LoWriter lo(path, 1, 3);
+            lo.AddFunction(MakeFunction({{}}));
+            lo.AddFunction(MakeFunction({{{Opcode::LOAD_INT, 0}, {Opcode::LOAD_INT, 1}, {Opcode::CALL_F, 2},
+                                          {Opcode::PRINT, INT_TYPE.type}}},
+                                        {depth, 0}));
+            lo.AddFunction(count);
+        }
+
+        VM vm = VM::DeserialiseProgram(path);
+        REQUIRE(RunProgram(vm) == std::to_string(depth) + "\n");
+        REQUIRE(vm.stack.GetCapacity() == DEF_SIZE);
+    }
+
+    std::filesystem::remove(path);
+}
\ No newline at end of file
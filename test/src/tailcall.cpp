@@ -0,0 +1,44 @@
+#include "../catch.h"
+
+#include "compiler.h"
+#include "parser.h"
+#include "staticanalyser.h"
+
+// whether an op in routines [begin, end) of the function is a TAIL_CALL
+static bool HasTailCall(const Function &f, size_t begin, size_t end)
+{
+    for (size_t i = begin; i < end; i++)
+        for (const Op &o : f.routines[i])
+            if (o.code == Opcode::TAIL_CALL)
+                return true;
+    return false;
+}
+
+TEST_CASE("Testing that calls are only made tail calls outside try clauses")
+{
+    SymbolTable symbols;
+    Parser p("scripts/tail_call.txt", symbols);
+    std::vector<SP<Stmt>> program = p.Parse();
+    StaticAnalyser sa(symbols);
+    sa.Analyse(program);
+
+    Compiler c;
+    c.Compile(program);
+    REQUIRE_FALSE(c.had_error);
+
+    SECTION("A call returned from outside a try clause is a tail call")
+    {
+        bool found = false;
+        for (const Function &f : c.functions)
+            found = found || HasTailCall(f, 0, f.routines.size());
+        REQUIRE(found);
+    }
+
+    // the VM unwinds a throw to the frame a tail call would replace
+    SECTION("A call returned from inside a try clause is not")
+    {
+        REQUIRE(c.throw_stack.size() == 1);
+        for (const ThrowInfo &ti : c.throw_stack)
+            REQUIRE_FALSE(HasTailCall(c.functions[ti.func], ti.begin, ti.end));
+    }
+}
\ No newline at end of file